@@ -0,0 +1,136 @@
+/*
+	arena.c ~ RL
+*/
+
+#include "arena.h"
+
+#include "thread.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_ALIGN(x) (((x) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+#define ARENA_SCRATCH_BLOCK_SIZE (1024 * 1024)
+
+struct arena_block
+{
+	struct arena_block* next;
+	size_t size;
+	size_t used;
+};
+
+struct arena
+{
+	/* NULL unless the arena is shared */
+	mutex_t lock;
+	size_t block_size;
+	/* head is the block being allocated from, the first block is last in the list */
+	struct arena_block* head;
+};
+
+static THREAD_LOCAL arena_t scratch;
+
+static struct arena_block* arena_block_create(size_t size, struct arena_block* next)
+{
+	struct arena_block* res = dig_malloc(ARENA_ALIGN(sizeof * res) + size);
+	res->next = next;
+	res->size = size;
+	res->used = 0;
+	return res;
+}
+
+arena_t arena_create(size_t block_size, bool is_shared)
+{
+	arena_t res = dig_malloc(sizeof * res);
+	res->lock = is_shared ? mutex_create() : NULL;
+	res->block_size = block_size;
+	res->head = arena_block_create(block_size, NULL);
+	return res;
+}
+
+void arena_destroy(arena_t arena)
+{
+	if (!arena)
+	{
+		return;
+	}
+	struct arena_block* block = arena->head;
+	while (block)
+	{
+		struct arena_block* next = block->next;
+		free(block);
+		block = next;
+	}
+	if (arena->lock)
+	{
+		mutex_destroy(arena->lock);
+	}
+	free(arena);
+}
+
+void* arena_alloc(arena_t arena, size_t size)
+{
+	size = ARENA_ALIGN(size);
+	if (arena->lock)
+	{
+		mutex_lock(arena->lock);
+	}
+	struct arena_block* block = arena->head;
+	if (block->size - block->used < size)
+	{
+		/* oversized allocations get a block of their own */
+		block = arena->head = arena_block_create(size > arena->block_size ? size : arena->block_size, arena->head);
+	}
+	void* res = (char*)block + ARENA_ALIGN(sizeof * block) + block->used;
+	block->used += size;
+	if (arena->lock)
+	{
+		mutex_unlock(arena->lock);
+	}
+	return res;
+}
+
+char* arena_strdup(arena_t arena, const char* string)
+{
+	size_t size = strlen(string) + 1;
+	char* res = arena_alloc(arena, size);
+	memcpy(res, string, size);
+	return res;
+}
+
+void arena_reset(arena_t arena)
+{
+	if (arena->lock)
+	{
+		mutex_lock(arena->lock);
+	}
+	if (arena->head->next)
+	{
+		/* everything that was needed goes into one block, so the same workload fits next time */
+		size_t size = 0;
+		struct arena_block* block = arena->head;
+		while (block)
+		{
+			struct arena_block* next = block->next;
+			size += block->size;
+			free(block);
+			block = next;
+		}
+		arena->head = arena_block_create(size, NULL);
+	}
+	arena->head->used = 0;
+	if (arena->lock)
+	{
+		mutex_unlock(arena->lock);
+	}
+}
+
+arena_t arena_scratch(void)
+{
+	/* lives as long as the thread, the loader threads are never torn down */
+	if (!scratch)
+	{
+		scratch = arena_create(ARENA_SCRATCH_BLOCK_SIZE, false);
+	}
+	return scratch;
+}
\ No newline at end of file
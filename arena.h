@@ -0,0 +1,23 @@
+/*
+	arena.h ~ RL
+
+	Bump allocator for data that all dies at once: per-load scratch buffers and the long-lived asset set.
+*/
+
+#pragma once
+
+#include "types.h"
+
+typedef struct arena* arena_t;
+
+/* Blocks are block_size bytes unless a bigger allocation needs more. A shared arena can be allocated from by several threads. */
+arena_t arena_create(size_t block_size, bool is_shared);
+/* Frees every allocation at once */
+void arena_destroy(arena_t arena);
+/* Never returns NULL, aligned to 16 bytes */
+void* arena_alloc(arena_t arena, size_t size);
+char* arena_strdup(arena_t arena, const char* string);
+/* Forgets every allocation but keeps the memory, so a reused arena stops allocating once it's warm */
+void arena_reset(arena_t arena);
+/* This thread's scratch arena, for temporaries that are reset before the caller returns */
+arena_t arena_scratch(void);
\ No newline at end of file
@@ -0,0 +1,337 @@
+/*
+	bench.c ~ RL
+*/
+
+#include "bench.h"
+
+#include "arena.h"
+#include "cache.h"
+#include "debug.h"
+#include "file.h"
+#include "log.h"
+#include "screen.h"
+#include "types.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#define BENCH_DIRECTORY "bench_assets"
+#define BENCH_ITERATIONS 5
+/* the composite benchmark draws this many sprites over a layer per frame */
+#define BENCH_COMPOSITE_SPRITES 48
+#define BENCH_COMPOSITE_SPRITE_SIZE 32
+#define BENCH_COMPOSITE_LAYER_SIZE 512
+#define BENCH_COMPOSITE_FRAMES 500
+/* block size of the arena a bulk load goes into */
+#define BENCH_ARENA_SIZE (16 * 1024 * 1024)
+
+/* From single tiles up to layer sized grids, with fewer files as they grow */
+static const struct bench_size
+{
+	int width, height, count;
+} sizes[] =
+{
+	{ 8, 8, 512 },
+	{ 16, 16, 256 },
+	{ 32, 32, 128 },
+	{ 64, 64, 64 },
+	{ TARGET_WIDTH, TARGET_HEIGHT, 32 },
+	{ 256, 256, 16 },
+	{ 512, 512, 8 },
+};
+
+struct bench_set
+{
+	const struct bench_size* size;
+	char** paths;
+	uint64_t bytes;
+};
+
+static uint32_t bench_random(uint32_t* state)
+{
+	/* xorshift32, the assets only need to be deterministic */
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static void bench_write_plane(FILE* handle, const char* header, int width, int height, int max, uint32_t* state)
+{
+	fprintf(handle, "#%s\r\n", header);
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			/* every value is followed by a space, including the last in a row, like the game's files */
+			fprintf(handle, "%u ", bench_random(state) % (max + 1));
+		}
+		fputs("\r\n", handle);
+	}
+}
+
+/* Writes a sprite in the same layout as the game, skipped sections included */
+static bool bench_generate(const char* path, int width, int height, uint32_t seed)
+{
+	FILE* handle = fopen(path, "wb");
+	if (!handle)
+	{
+		log_error("Failed to create \"%s\"\n", path);
+		return false;
+	}
+	uint32_t state = seed | 1;
+	fprintf(handle, "#Width\r\n%i\r\n#Height\r\n%i\r\n", width, height);
+	bench_write_plane(handle, "Image", width, height, 255, &state);
+	bench_write_plane(handle, "Color", width, height, 255, &state);
+	bench_write_plane(handle, "TileType", width, height, 3, &state);
+	fprintf(handle, "#X weather\r\n%u %u %u.%u\r\n", bench_random(&state) % 4, bench_random(&state) % 4, bench_random(&state) % 10, bench_random(&state) % 100);
+	fprintf(handle, "#PaletteColor\r\n%u\r\n", bench_random(&state) % 2);
+	bench_write_plane(handle, "Transparency", width, height, 1, &state);
+	return fclose(handle) == 0;
+}
+
+static bool bench_generate_set(struct bench_set* set, const struct bench_size* size)
+{
+	set->size = size;
+	set->bytes = 0;
+	set->paths = dig_malloc(size->count * sizeof * set->paths);
+	for (int i = 0; i < size->count; i++)
+	{
+		char path[128];
+		snprintf(path, sizeof path, BENCH_DIRECTORY "/%ix%i_%03i.txt", size->width, size->height, i);
+		set->paths[i] = dig_malloc(strlen(path) + 1);
+		strcpy(set->paths[i], path);
+
+		uint64_t mtime, bytes;
+		/* generated once, later runs reuse the files */
+		if (!file_stat(path, &mtime, &bytes))
+		{
+			if (!bench_generate(path, size->width, size->height, size->width * 7919 + size->height * 104729 + i))
+			{
+				return false;
+			}
+			file_stat(path, &mtime, &bytes);
+		}
+		set->bytes += bytes;
+	}
+	return true;
+}
+
+static void bench_free_set(struct bench_set* set)
+{
+	for (int i = 0; i < set->size->count; i++)
+	{
+		free(set->paths[i]);
+	}
+	free(set->paths);
+}
+
+static int bench_compare_u64(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t bench_percentile(const uint64_t* sorted, int count, int percentile)
+{
+	int index = (int)((int64_t)(count - 1) * percentile / 100);
+	return sorted[index];
+}
+
+/* Loads every file of a set one at a time, BENCH_ITERATIONS times, and reports throughput and per file latency */
+static bool bench_sequential(FILE* out, const char* name, struct bench_set* set)
+{
+	int samples = set->size->count * BENCH_ITERATIONS;
+	uint64_t* latencies = dig_malloc(samples * sizeof * latencies);
+#ifdef DIG_BENCH
+	uint64_t allocations = dig_allocation_count;
+#endif
+	uint64_t total = 0;
+	bool ok = true;
+
+	for (int iteration = 0; iteration < BENCH_ITERATIONS; iteration++)
+	{
+		for (int i = 0; i < set->size->count; i++)
+		{
+			uint64_t start = debug_time_ns();
+			sprite_t sprite = file_load_sprite(set->paths[i]);
+			uint64_t elapsed = debug_time_ns() - start;
+			ok = ok && sprite;
+			screen_sprite_destroy(sprite);
+			latencies[iteration * set->size->count + i] = elapsed;
+			total += elapsed;
+		}
+	}
+	/* null unless built with DIG_BENCH, normal builds don't count allocations */
+	char allocations_per_load[32] = "null";
+#ifdef DIG_BENCH
+	snprintf(allocations_per_load, sizeof allocations_per_load, "%.2f", (double)(dig_allocation_count - allocations) / samples);
+#endif
+
+	qsort(latencies, samples, sizeof * latencies, bench_compare_u64);
+	double seconds = total / 1e9;
+	double cells = (double)set->size->width * set->size->height * samples;
+	fprintf(out, "{\"benchmark\":\"%s\",\"width\":%i,\"height\":%i,\"files\":%i,\"iterations\":%i,\"bytes\":%llu,"
+		"\"mb_per_s\":%.2f,\"cells_per_s\":%.0f,\"allocations_per_load\":%s,"
+		"\"p50_us\":%.2f,\"p90_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f,\"ok\":%s}\n",
+		name, set->size->width, set->size->height, set->size->count, BENCH_ITERATIONS, (unsigned long long)set->bytes,
+		set->bytes * (double)BENCH_ITERATIONS / 1e6 / seconds, cells / seconds, allocations_per_load,
+		bench_percentile(latencies, samples, 50) / 1e3, bench_percentile(latencies, samples, 90) / 1e3,
+		bench_percentile(latencies, samples, 99) / 1e3, latencies[samples - 1] / 1e3, ok ? "true" : "false");
+
+	free(latencies);
+	return ok;
+}
+
+/* Loads the whole set at once with the parallel loader */
+static bool bench_bulk(FILE* out, struct bench_set* set)
+{
+	int count = set->size->count;
+	sprite_t* sprites = dig_malloc(count * sizeof * sprites);
+	file_status_t* statuses = dig_malloc(count * sizeof * statuses);
+
+	uint64_t best = UINT64_MAX;
+	bool ok = true;
+	for (int iteration = 0; iteration < BENCH_ITERATIONS; iteration++)
+	{
+		uint64_t start = debug_time_ns();
+		arena_t arena = arena_create(BENCH_ARENA_SIZE, true);
+		int loaded = file_load_sprites(set->paths, count, arena, sprites, statuses);
+		arena_destroy(arena);
+		uint64_t elapsed = debug_time_ns() - start;
+		best = elapsed < best ? elapsed : best;
+		ok = ok && loaded == count;
+	}
+
+	fprintf(out, "{\"benchmark\":\"bulk\",\"width\":%i,\"height\":%i,\"files\":%i,\"iterations\":%i,\"bytes\":%llu,"
+		"\"best_ms\":%.3f,\"mb_per_s\":%.2f,\"ok\":%s}\n",
+		set->size->width, set->size->height, count, BENCH_ITERATIONS, (unsigned long long)set->bytes,
+		best / 1e6, set->bytes / 1e6 / (best / 1e9), ok ? "true" : "false");
+
+	free(sprites);
+	free(statuses);
+	return ok;
+}
+
+/* Builds a sprite with random cells, and about half of them transparent if is_transparent */
+static sprite_t bench_random_sprite(int width, int height, bool is_transparent, uint32_t* state)
+{
+	size_t cells = (size_t)width * height;
+	char* text = dig_malloc(cells);
+	attribute_t* attrib = dig_malloc(cells * sizeof * attrib);
+	uint8_t* transparency = dig_malloc(cells);
+	for (size_t i = 0; i < cells; i++)
+	{
+		text[i] = (char)bench_random(state);
+		attrib[i] = (attribute_t)bench_random(state);
+		transparency[i] = is_transparent && bench_random(state) % 2;
+	}
+	sprite_t res = screen_sprite_create_frames(&(sprite_data_t) { width, height, 1, -1, text, attrib, transparency, NULL }, NULL);
+	free(text);
+	free(attrib);
+	free(transparency);
+	return res;
+}
+
+/*
+	A big layer with transparent sprites on top, drawn straight into the screen's frame the way a repaint
+	would, without presenting anything
+*/
+static bool bench_composite(FILE* out)
+{
+	uint32_t state = 0xD16;
+	sprite_t layer = bench_random_sprite(BENCH_COMPOSITE_LAYER_SIZE, BENCH_COMPOSITE_LAYER_SIZE, false, &state);
+	sprite_t sprites[BENCH_COMPOSITE_SPRITES];
+	for (int i = 0; i < BENCH_COMPOSITE_SPRITES; i++)
+	{
+		sprites[i] = bench_random_sprite(BENCH_COMPOSITE_SPRITE_SIZE, BENCH_COMPOSITE_SPRITE_SIZE, true, &state);
+	}
+
+	uint64_t* latencies = dig_malloc(BENCH_COMPOSITE_FRAMES * sizeof * latencies);
+	for (int i = 0; i < BENCH_COMPOSITE_FRAMES; i++)
+	{
+		/* the camera and sprites move every frame, like scrolling around a level */
+		int camera_x = bench_random(&state) % (BENCH_COMPOSITE_LAYER_SIZE - TARGET_WIDTH);
+		int camera_y = bench_random(&state) % (BENCH_COMPOSITE_LAYER_SIZE - TARGET_HEIGHT);
+		uint64_t start = debug_time_ns();
+		screen_sprite_render(-camera_x, -camera_y, layer);
+		for (int j = 0; j < BENCH_COMPOSITE_SPRITES; j++)
+		{
+			int x = (int)(bench_random(&state) % (TARGET_WIDTH + BENCH_COMPOSITE_SPRITE_SIZE)) - BENCH_COMPOSITE_SPRITE_SIZE;
+			int y = (int)(bench_random(&state) % (TARGET_HEIGHT + BENCH_COMPOSITE_SPRITE_SIZE)) - BENCH_COMPOSITE_SPRITE_SIZE;
+			screen_sprite_render(x, y, sprites[j]);
+		}
+		latencies[i] = debug_time_ns() - start;
+	}
+	qsort(latencies, BENCH_COMPOSITE_FRAMES, sizeof * latencies, bench_compare_u64);
+
+	uint64_t total = 0;
+	for (int i = 0; i < BENCH_COMPOSITE_FRAMES; i++)
+	{
+		total += latencies[i];
+	}
+	fprintf(out, "{\"benchmark\":\"composite\",\"layer\":%i,\"sprites\":%i,\"sprite_size\":%i,\"frames\":%i,"
+		"\"frames_per_s\":%.0f,\"p50_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f,\"ok\":true}\n",
+		BENCH_COMPOSITE_LAYER_SIZE, BENCH_COMPOSITE_SPRITES, BENCH_COMPOSITE_SPRITE_SIZE, BENCH_COMPOSITE_FRAMES,
+		BENCH_COMPOSITE_FRAMES / (total / 1e9), bench_percentile(latencies, BENCH_COMPOSITE_FRAMES, 50) / 1e3,
+		bench_percentile(latencies, BENCH_COMPOSITE_FRAMES, 99) / 1e3, latencies[BENCH_COMPOSITE_FRAMES - 1] / 1e3);
+
+	free(latencies);
+	screen_sprite_destroy(layer);
+	for (int i = 0; i < BENCH_COMPOSITE_SPRITES; i++)
+	{
+		screen_sprite_destroy(sprites[i]);
+	}
+	return true;
+}
+
+int bench_run(const char* output_path)
+{
+	FILE* out = output_path ? fopen(output_path, "w") : stdout;
+	if (!out)
+	{
+		log_error("Failed to open \"%s\"\n", output_path);
+		return 1;
+	}
+#ifdef _WIN32
+	CreateDirectoryA(BENCH_DIRECTORY, NULL);
+#else
+	mkdir(BENCH_DIRECTORY, 0755);
+#endif
+
+	bool ok = true;
+	for (int i = 0; i < (int)(sizeof sizes / sizeof * sizes) && ok; i++)
+	{
+		struct bench_set set;
+		ok = bench_generate_set(&set, &sizes[i]);
+		if (!ok)
+		{
+			break;
+		}
+
+		/* parse is the text format every time, cached is warm binary loads once every file has been compiled */
+		cache_enable(false);
+		ok = bench_sequential(out, "parse", &set) && bench_bulk(out, &set);
+		cache_enable(true);
+		for (int j = 0; j < set.size->count; j++)
+		{
+			screen_sprite_destroy(file_load_sprite(set.paths[j]));
+		}
+		ok = ok && bench_sequential(out, "cached", &set);
+		fflush(out);
+
+		bench_free_set(&set);
+	}
+	ok = ok && bench_composite(out);
+
+	if (out != stdout)
+	{
+		fclose(out);
+	}
+	return ok ? 0 : 1;
+}
\ No newline at end of file
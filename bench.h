@@ -0,0 +1,10 @@
+/*
+	bench.h ~ RL
+
+	Parser and loader benchmarks over generated assets, reported as one JSON object per line.
+*/
+
+#pragma once
+
+/* Returns the process exit code */
+int bench_run(const char* output_path);
\ No newline at end of file
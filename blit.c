@@ -0,0 +1,245 @@
+/*
+	blit.c ~ RL
+*/
+
+#include "blit.h"
+
+/* SSE2 is the baseline the x86 kernels assume, like FILE_SSE2, so 32 bit builds without it get the scalar ones */
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define BLIT_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define BLIT_TARGET_AVX2
+#else
+#define BLIT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+#include <string.h>
+
+typedef void (*blit_interleave_t)(cell_t* dst, const char* text, const attribute_t* attrib, int count);
+typedef void (*blit_interleave_masked_t)(cell_t* dst, const char* text, const attribute_t* attrib, const uint8_t* mask, size_t bit, int count);
+typedef void (*blit_fill_t)(cell_t* dst, cell_t cell, int count);
+
+/* At least the 24 mask bits from bit onwards, in the low bits */
+static inline uint32_t blit_mask_bits(const uint8_t* mask, size_t bit)
+{
+	uint32_t res;
+	memcpy(&res, mask + (bit >> 3), sizeof res);
+	return res >> (bit & 7);
+}
+
+static void blit_interleave_scalar(cell_t* dst, const char* text, const attribute_t* attrib, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		dst[i].ch = (unsigned char)text[i];
+		dst[i].attrib = attrib[i];
+	}
+}
+
+/* Selects with the mask instead of branching, so it costs the same whatever the mask holds */
+static void blit_interleave_masked_scalar(cell_t* dst, const char* text, const attribute_t* attrib, const uint8_t* mask, size_t bit, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		uint32_t keep = 0u - (blit_mask_bits(mask, bit + i) & 1);
+		cell_t cell = { (unsigned char)text[i], attrib[i] };
+		uint32_t src, old;
+		memcpy(&src, &cell, sizeof src);
+		memcpy(&old, &dst[i], sizeof old);
+		old = (src & keep) | (old & ~keep);
+		memcpy(&dst[i], &old, sizeof old);
+	}
+}
+
+static void blit_fill_scalar(cell_t* dst, cell_t cell, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		dst[i] = cell;
+	}
+}
+
+#ifdef BLIT_X86
+static bool blit_has_avx2(void)
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return false;
+	}
+	__cpuid(info, 1);
+	/* OSXSAVE and AVX, then make sure the OS saves the YMM registers */
+	if ((info[2] & (1 << 27 | 1 << 28)) != (1 << 27 | 1 << 28) || (_xgetbv(0) & 6) != 6)
+	{
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & 1 << 5) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static void blit_interleave_sse2(cell_t* dst, const char* text, const attribute_t* attrib, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i ch = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(text + i)), zero);
+		__m128i at = _mm_loadu_si128((const __m128i*)(attrib + i));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(ch, at));
+		_mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(ch, at));
+	}
+	blit_interleave_scalar(dst + i, text + i, attrib + i, count - i);
+}
+
+static void blit_fill_sse2(cell_t* dst, cell_t cell, int count)
+{
+	uint32_t value;
+	memcpy(&value, &cell, sizeof value);
+	const __m128i cells = _mm_set1_epi32((int)value);
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		_mm_storeu_si128((__m128i*)(dst + i), cells);
+	}
+	blit_fill_scalar(dst + i, cell, count - i);
+}
+
+/* Each cell is one 32-bit lane, its mask bit is spread over the lane by testing it against the lane's bit */
+static inline __m128i blit_select_sse2(__m128i bits, __m128i lane_bits, __m128i src, __m128i old)
+{
+	__m128i keep = _mm_cmpeq_epi32(_mm_and_si128(bits, lane_bits), lane_bits);
+	return _mm_or_si128(_mm_and_si128(keep, src), _mm_andnot_si128(keep, old));
+}
+
+static void blit_interleave_masked_sse2(cell_t* dst, const char* text, const attribute_t* attrib, const uint8_t* mask, size_t bit, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lo_bits = _mm_setr_epi32(1, 2, 4, 8);
+	const __m128i hi_bits = _mm_setr_epi32(16, 32, 64, 128);
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i bits = _mm_set1_epi32(blit_mask_bits(mask, bit + i));
+		__m128i ch = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(text + i)), zero);
+		__m128i at = _mm_loadu_si128((const __m128i*)(attrib + i));
+		__m128i* out = (__m128i*)(dst + i);
+		_mm_storeu_si128(out, blit_select_sse2(bits, lo_bits, _mm_unpacklo_epi16(ch, at), _mm_loadu_si128(out)));
+		_mm_storeu_si128(out + 1, blit_select_sse2(bits, hi_bits, _mm_unpackhi_epi16(ch, at), _mm_loadu_si128(out + 1)));
+	}
+	blit_interleave_masked_scalar(dst + i, text + i, attrib + i, mask, bit + i, count - i);
+}
+
+BLIT_TARGET_AVX2 static void blit_interleave_avx2(cell_t* dst, const char* text, const attribute_t* attrib, int count)
+{
+	int i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i ch = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(text + i)));
+		__m256i at = _mm256_loadu_si256((const __m256i*)(attrib + i));
+		/* unpacks work within 128-bit lanes, lo holds cells 0-3 and 8-11, hi holds 4-7 and 12-15 */
+		__m256i lo = _mm256_unpacklo_epi16(ch, at);
+		__m256i hi = _mm256_unpackhi_epi16(ch, at);
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i*)(dst + i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	blit_interleave_sse2(dst + i, text + i, attrib + i, count - i);
+}
+
+BLIT_TARGET_AVX2 static void blit_fill_avx2(cell_t* dst, cell_t cell, int count)
+{
+	uint32_t value;
+	memcpy(&value, &cell, sizeof value);
+	const __m256i cells = _mm256_set1_epi32((int)value);
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		_mm256_storeu_si256((__m256i*)(dst + i), cells);
+	}
+	blit_fill_sse2(dst + i, cell, count - i);
+}
+
+/* A real masked store, cells that aren't drawn are never read or written */
+BLIT_TARGET_AVX2 static void blit_interleave_masked_avx2(cell_t* dst, const char* text, const attribute_t* attrib, const uint8_t* mask, size_t bit, int count)
+{
+	const __m256i lo_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	const __m256i hi_bits = _mm256_slli_epi32(lo_bits, 8);
+	int i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i bits = _mm256_set1_epi32(blit_mask_bits(mask, bit + i));
+		__m256i ch = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(text + i)));
+		__m256i at = _mm256_loadu_si256((const __m256i*)(attrib + i));
+		__m256i lo = _mm256_unpacklo_epi16(ch, at);
+		__m256i hi = _mm256_unpackhi_epi16(ch, at);
+		_mm256_maskstore_epi32((int*)(dst + i), _mm256_cmpeq_epi32(_mm256_and_si256(bits, lo_bits), lo_bits), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_maskstore_epi32((int*)(dst + i + 8), _mm256_cmpeq_epi32(_mm256_and_si256(bits, hi_bits), hi_bits), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	blit_interleave_masked_sse2(dst + i, text + i, attrib + i, mask, bit + i, count - i);
+}
+#endif
+
+static blit_interleave_t blit_select_interleave(void)
+{
+#ifdef BLIT_X86
+	return blit_has_avx2() ? blit_interleave_avx2 : blit_interleave_sse2;
+#else
+	return blit_interleave_scalar;
+#endif
+}
+
+static blit_interleave_masked_t blit_select_interleave_masked(void)
+{
+#ifdef BLIT_X86
+	return blit_has_avx2() ? blit_interleave_masked_avx2 : blit_interleave_masked_sse2;
+#else
+	return blit_interleave_masked_scalar;
+#endif
+}
+
+static blit_fill_t blit_select_fill(void)
+{
+#ifdef BLIT_X86
+	return blit_has_avx2() ? blit_fill_avx2 : blit_fill_sse2;
+#else
+	return blit_fill_scalar;
+#endif
+}
+
+void blit_interleave(cell_t* dst, const char* text, const attribute_t* attrib, int count)
+{
+	/* racing threads would all pick the same kernel, so there's nothing to guard */
+	static blit_interleave_t kernel;
+	if (!kernel)
+	{
+		kernel = blit_select_interleave();
+	}
+	kernel(dst, text, attrib, count);
+}
+
+void blit_interleave_masked(cell_t* dst, const char* text, const attribute_t* attrib, const uint8_t* mask, size_t bit, int count)
+{
+	static blit_interleave_masked_t kernel;
+	if (!kernel)
+	{
+		kernel = blit_select_interleave_masked();
+	}
+	kernel(dst, text, attrib, mask, bit, count);
+}
+
+void blit_fill(cell_t* dst, cell_t cell, int count)
+{
+	static blit_fill_t kernel;
+	if (!kernel)
+	{
+		kernel = blit_select_fill();
+	}
+	kernel(dst, cell, count);
+}
\ No newline at end of file
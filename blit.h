@@ -0,0 +1,22 @@
+/*
+	blit.h ~ RL
+
+	Cell kernels used by the screen module. Each has an AVX2 and SSE2 version picked at runtime, and a scalar fallback.
+*/
+
+#pragma once
+
+#include "screen_backend.h"
+#include "types.h"
+
+/* Widens count chars and pairs them with their attributes, dst[i] = { text[i], attrib[i] } */
+void blit_interleave(cell_t* dst, const char* text, const attribute_t* attrib, int count);
+/*
+	Same as blit_interleave, but only cells whose bit is set in mask are written, the rest of dst is left alone.
+	Cell i uses bit (bit + i), counting from the low bit of mask[0]. Masks are read a few bytes past the last bit
+	they use, so they need BLIT_MASK_PADDING spare bytes at the end.
+*/
+void blit_interleave_masked(cell_t* dst, const char* text, const attribute_t* attrib, const uint8_t* mask, size_t bit, int count);
+#define BLIT_MASK_PADDING 4
+/* Writes the same cell count times, for runs of identical cells */
+void blit_fill(cell_t* dst, cell_t cell, int count);
\ No newline at end of file
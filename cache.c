@@ -0,0 +1,317 @@
+/*
+	cache.c ~ RL
+*/
+
+#include "cache.h"
+
+#include "log.h"
+#include "screen.h"
+#include "thread.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#define CACHE_SEPARATOR "\\"
+#else
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CACHE_SEPARATOR "/"
+#endif
+
+#define CACHE_MAGIC 0x43524E44 /* "DNRC" */
+#define CACHE_VERSION 3
+#define CACHE_ALIGNMENT 8
+#define CACHE_ALIGN(x) (((x) + CACHE_ALIGNMENT - 1) & ~(size_t)(CACHE_ALIGNMENT - 1))
+#define CACHE_PATH_MAX 4096
+
+/* Numbers the temporary files, so writers storing the same source at once never share one */
+static volatile int32_t temp_counter;
+
+/*
+	Layout of a cache file:
+		header
+		absolute source path (path_length bytes, not terminated)
+		every plane of the built sprite in sprite_plane_t order, at offsets[plane] with sizes[plane] bytes, both 0 when absent
+	Every plane is aligned to CACHE_ALIGNMENT, like they are in a sprite, so loading is a copy per plane.
+*/
+struct cache_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t source_mtime;
+	uint64_t source_size;
+	int32_t width;
+	int32_t height;
+	int32_t frame_count;
+	int32_t palette;
+	uint32_t path_length;
+	uint32_t offsets[SPRITE_PLANE_COUNT];
+	uint32_t sizes[SPRITE_PLANE_COUNT];
+};
+
+static bool is_enabled = true;
+
+/* Found by the first load or store, like log_start */
+static struct cache_state
+{
+	volatile int32_t start_claim;
+	volatile int32_t is_started;
+	/* in the user's cache directory, empty when there isn't one and nothing is cached */
+	char directory[CACHE_PATH_MAX];
+	/* relative sources are keyed from here, so a file has one entry whatever directory the tool runs in */
+	char working_directory[CACHE_PATH_MAX];
+} cache_state;
+
+void cache_enable(bool enabled)
+{
+	is_enabled = enabled;
+}
+
+#ifdef _WIN32
+static void cache_find_directory(void)
+{
+	const char* base = getenv("LOCALAPPDATA");
+	if (!base || !*base)
+	{
+		return;
+	}
+	/* leaves room for the subdirectory */
+	char parent[CACHE_PATH_MAX - 32];
+	snprintf(parent, sizeof parent, "%s\\DigNRigModder", base);
+	snprintf(cache_state.directory, sizeof cache_state.directory, "%s\\cache\\", parent);
+	CreateDirectoryA(parent, NULL);
+	CreateDirectoryA(cache_state.directory, NULL);
+	DWORD length = GetCurrentDirectoryA(sizeof cache_state.working_directory, cache_state.working_directory);
+	if (length == 0 || length >= sizeof cache_state.working_directory)
+	{
+		cache_state.directory[0] = 0;
+	}
+}
+#else
+static void cache_find_directory(void)
+{
+	/* leaves room for the subdirectory */
+	char parent[CACHE_PATH_MAX - 32];
+	const char* base = getenv("XDG_CACHE_HOME");
+	if (base && *base)
+	{
+		snprintf(parent, sizeof parent, "%s", base);
+	}
+	else if ((base = getenv("HOME")) && *base)
+	{
+		snprintf(parent, sizeof parent, "%s/.cache", base);
+	}
+	else
+	{
+		return;
+	}
+	snprintf(cache_state.directory, sizeof cache_state.directory, "%s/dignrigmodder/", parent);
+	mkdir(parent, 0755);
+	mkdir(cache_state.directory, 0755);
+	if (!getcwd(cache_state.working_directory, sizeof cache_state.working_directory))
+	{
+		cache_state.directory[0] = 0;
+	}
+}
+#endif
+
+static void cache_start(void)
+{
+	if (atomic_add32(&cache_state.start_claim, 1) != 1)
+	{
+		while (!atomic_load32(&cache_state.is_started))
+		{
+			thread_sleep(0);
+		}
+		return;
+	}
+	cache_find_directory();
+	if (!cache_state.directory[0])
+	{
+		log_warning("There's no user cache directory, sprites won't be cached\n");
+	}
+	atomic_store32(&cache_state.is_started, 1);
+}
+
+static bool cache_is_available(void)
+{
+	if (!is_enabled)
+	{
+		return false;
+	}
+	if (!atomic_load32(&cache_state.is_started))
+	{
+		cache_start();
+	}
+	return cache_state.directory[0] != 0;
+}
+
+static bool cache_is_absolute(const char* path)
+{
+#ifdef _WIN32
+	return path[0] == '\\' || path[0] == '/' || (path[0] && path[1] == ':');
+#else
+	return path[0] == '/';
+#endif
+}
+
+/* The source's absolute path, which names its entry. Returns false if it's too long to have one. */
+static bool cache_key(const char* source, char* key, size_t size)
+{
+	int length = cache_is_absolute(source)
+		? snprintf(key, size, "%s", source)
+		: snprintf(key, size, "%s" CACHE_SEPARATOR "%s", cache_state.working_directory, source);
+	return length > 0 && (size_t)length < size;
+}
+
+static void cache_path(const char* key, char* buf, size_t size)
+{
+	snprintf(buf, size, "%s%016llx.dnrc", cache_state.directory, (unsigned long long)dig_hash(key, strlen(key)));
+}
+
+sprite_t cache_load_sprite(const char* source, arena_t arena)
+{
+	uint64_t mtime, size;
+	char key[CACHE_PATH_MAX * 2];
+	if (!cache_is_available() || !cache_key(source, key, sizeof key) || !file_stat(source, &mtime, &size))
+	{
+		return NULL;
+	}
+
+	char path[CACHE_PATH_MAX + 32];
+	cache_path(key, path, sizeof path);
+	file_view_t view;
+	if (!file_map(path, &view))
+	{
+		return NULL;
+	}
+
+	sprite_t res = NULL;
+	const struct cache_header* header = (const struct cache_header*)view.data;
+	size_t path_length = strlen(key);
+	if (view.size < sizeof * header
+		|| header->magic != CACHE_MAGIC
+		|| header->version != CACHE_VERSION
+		|| header->source_mtime != mtime
+		|| header->source_size != size
+		|| header->path_length != path_length
+		|| sizeof * header + path_length > view.size
+		|| memcmp(view.data + sizeof * header, key, path_length) != 0)
+	{
+		goto cleanup;
+	}
+
+	sprite_image_t image =
+	{
+		.width = header->width,
+		.height = header->height,
+		.frame_count = header->frame_count,
+		.palette = header->palette,
+	};
+	for (int plane = 0; plane < SPRITE_PLANE_COUNT; plane++)
+	{
+		uint64_t offset = header->offsets[plane], plane_size = header->sizes[plane];
+		if (plane_size && (offset < sizeof * header + path_length || offset % CACHE_ALIGNMENT || offset + plane_size > view.size))
+		{
+			goto cleanup;
+		}
+		image.planes[plane] = plane_size ? view.data + offset : NULL;
+		image.sizes[plane] = (size_t)plane_size;
+	}
+	/* the sizes are checked against the header's dimensions there, so a damaged file is just a miss */
+	res = screen_sprite_create_image(&image, arena);
+cleanup:
+	file_unmap(&view);
+	return res;
+}
+
+/* Pads up to the next aligned offset and writes the plane there, NULL planes are skipped */
+static bool cache_write_plane(FILE* handle, size_t* written, const void* plane, size_t bytes)
+{
+	static const char zeroes[CACHE_ALIGNMENT];
+	if (!plane)
+	{
+		return true;
+	}
+	size_t padding = CACHE_ALIGN(*written) - *written;
+	*written += padding + bytes;
+	return fwrite(zeroes, 1, padding, handle) == padding && fwrite(plane, 1, bytes, handle) == bytes;
+}
+
+void cache_store_sprite(const char* source, const file_view_t* source_view, sprite_t sprite)
+{
+	char key[CACHE_PATH_MAX * 2];
+	if (!cache_is_available() || !cache_key(source, key, sizeof key))
+	{
+		return;
+	}
+
+	sprite_image_t image;
+	screen_sprite_image(sprite, &image);
+	struct cache_header header =
+	{
+		.magic = CACHE_MAGIC,
+		.version = CACHE_VERSION,
+		.source_mtime = source_view->mtime,
+		.source_size = source_view->size,
+		.width = image.width,
+		.height = image.height,
+		.frame_count = image.frame_count,
+		.palette = image.palette,
+		.path_length = (uint32_t)strlen(key),
+	};
+	size_t end = sizeof header + header.path_length;
+	for (int plane = 0; plane < SPRITE_PLANE_COUNT; plane++)
+	{
+		if (image.sizes[plane])
+		{
+			size_t offset = CACHE_ALIGN(end);
+			end = offset + image.sizes[plane];
+			header.offsets[plane] = (uint32_t)offset;
+			header.sizes[plane] = (uint32_t)image.sizes[plane];
+		}
+	}
+	if (end > UINT32_MAX)
+	{
+		/* offsets wouldn't fit, a sprite this big just isn't cached */
+		return;
+	}
+
+	char path[CACHE_PATH_MAX + 32], temp[CACHE_PATH_MAX + 64];
+	cache_path(key, path, sizeof path);
+#ifdef _WIN32
+	unsigned long process = GetCurrentProcessId();
+#else
+	unsigned long process = (unsigned long)getpid();
+#endif
+	/* unique to this writer, whichever rename comes last wins with a complete file */
+	snprintf(temp, sizeof temp, "%s.%lu.%i.tmp", path, process, (int)atomic_add32(&temp_counter, 1));
+
+	/* written under a temporary name first so a reader never maps a half written file */
+	FILE* handle = fopen(temp, "wb");
+	if (!handle)
+	{
+		log_warning("Failed to create cache file \"%s\"\n", temp);
+		return;
+	}
+	size_t written = sizeof header + header.path_length;
+	bool ok = fwrite(&header, sizeof header, 1, handle) == 1
+		&& fwrite(key, 1, header.path_length, handle) == header.path_length;
+	for (int plane = 0; plane < SPRITE_PLANE_COUNT && ok; plane++)
+	{
+		ok = cache_write_plane(handle, &written, image.planes[plane], image.sizes[plane]);
+	}
+	ok = fclose(handle) == 0 && ok;
+
+#ifdef _WIN32
+	ok = ok && MoveFileExA(temp, path, MOVEFILE_REPLACE_EXISTING);
+#else
+	ok = ok && rename(temp, path) == 0;
+#endif
+	if (!ok)
+	{
+		log_warning("Failed to write cache file \"%s\"\n", path);
+		remove(temp);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+/*
+	cache.h ~ RL
+
+	Compiled binary copies of built sprites, so warm loads skip the text format and building entirely.
+	They're kept in the user's cache directory: %LOCALAPPDATA%\DigNRigModder\cache on Windows,
+	$XDG_CACHE_HOME/dignrigmodder or ~/.cache/dignrigmodder elsewhere.
+*/
+
+#pragma once
+
+#include "file.h"
+#include "screen.h"
+#include "types.h"
+
+/* On by default. With the cache off, every load parses the text format and nothing is written. */
+void cache_enable(bool enabled);
+/* The sprite is allocated from arena, or the heap if it's NULL */
+sprite_t cache_load_sprite(const char* source, arena_t arena);
+void cache_store_sprite(const char* source, const file_view_t* source_view, sprite_t sprite);
\ No newline at end of file
@@ -3,38 +3,31 @@
 */
 
 #include "debug.h"
-#include <stdlib.h>
-#include <strsafe.h>
+#include "types.h"
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <time.h>
+#endif
 
-void debug_format(const char* fmt, ...)
-{
-	static char* current_buffer = NULL;
-	static int size;
-
-	if (!current_buffer)
-	{
-		size = 256;
-		current_buffer = malloc(size * sizeof * current_buffer);
-		if (!current_buffer)
-		{
-			exit(-10); /* The program most certainly couldn't run if it can't allocate 256 bytes */
-		}
-	}
+#ifdef DIG_BENCH
+THREAD_LOCAL uint64_t dig_allocation_count;
+#endif
 
-	va_list list;
-	va_start(list, fmt);
-	while (StringCbVPrintfA(current_buffer, size, fmt, list) == STRSAFE_E_INSUFFICIENT_BUFFER)
+uint64_t debug_time_ns(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	if (!frequency.QuadPart)
 	{
-		free(current_buffer);
-		size *= 2;
-		current_buffer = malloc(size * sizeof * current_buffer);
-		if (!current_buffer)
-		{
-			exit(-10);
-		}
+		QueryPerformanceFrequency(&frequency);
 	}
-	va_end(list);
-
-	OutputDebugStringA(current_buffer);
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000 + (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
 }
\ No newline at end of file
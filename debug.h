@@ -4,4 +4,7 @@
 
 #pragma once
 
-void debug_format(const char* fmt, ...);
\ No newline at end of file
+#include <stdint.h>
+
+/* Monotonic clock for timing, in nanoseconds */
+uint64_t debug_time_ns(void);
\ No newline at end of file
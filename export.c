@@ -0,0 +1,365 @@
+/*
+	export.c ~ RL
+*/
+
+#include "export.h"
+
+#include "arena.h"
+#include "log.h"
+#include "screen.h"
+#include "thread.h"
+#include <stdio.h>
+#include <string.h>
+
+#define EXPORT_GLYPH_SIZE TARGET_CELL_SIZE
+/* every char and the color byte of every attribute */
+#define EXPORT_TILE_COUNT (256 * 256)
+#define EXPORT_TILE_BYTES (EXPORT_GLYPH_SIZE * EXPORT_GLYPH_SIZE * 3)
+
+/* Printable ASCII from ' ' to '~', a row per byte from the top with bit 0 the leftmost pixel */
+static const uint8_t export_font[95][EXPORT_GLYPH_SIZE] =
+{
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	{ 0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00 },
+	{ 0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	{ 0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00 },
+	{ 0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00 },
+	{ 0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00 },
+	{ 0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00 },
+	{ 0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	{ 0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00 },
+	{ 0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00 },
+	{ 0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00 },
+	{ 0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00 },
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06 },
+	{ 0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00 },
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00 },
+	{ 0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00 },
+	{ 0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00 },
+	{ 0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00 },
+	{ 0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00 },
+	{ 0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00 },
+	{ 0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00 },
+	{ 0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00 },
+	{ 0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00 },
+	{ 0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00 },
+	{ 0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00 },
+	{ 0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00 },
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00 },
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06 },
+	{ 0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00 },
+	{ 0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00 },
+	{ 0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00 },
+	{ 0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00 },
+	{ 0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00 },
+	{ 0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00 },
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00 },
+	{ 0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00 },
+	{ 0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00 },
+	{ 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00 },
+	{ 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00 },
+	{ 0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00 },
+	{ 0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00 },
+	{ 0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },
+	{ 0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00 },
+	{ 0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00 },
+	{ 0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00 },
+	{ 0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00 },
+	{ 0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00 },
+	{ 0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00 },
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00 },
+	{ 0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00 },
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00 },
+	{ 0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00 },
+	{ 0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },
+	{ 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00 },
+	{ 0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },
+	{ 0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00 },
+	{ 0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00 },
+	{ 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00 },
+	{ 0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00 },
+	{ 0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00 },
+	{ 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00 },
+	{ 0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00 },
+	{ 0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00 },
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF },
+	{ 0x0C, 0x0C, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	{ 0x00, 0x00, 0x1E, 0x30, 0x3E, 0x33, 0x6E, 0x00 },
+	{ 0x07, 0x06, 0x06, 0x3E, 0x66, 0x66, 0x3B, 0x00 },
+	{ 0x00, 0x00, 0x1E, 0x33, 0x03, 0x33, 0x1E, 0x00 },
+	{ 0x38, 0x30, 0x30, 0x3E, 0x33, 0x33, 0x6E, 0x00 },
+	{ 0x00, 0x00, 0x1E, 0x33, 0x3F, 0x03, 0x1E, 0x00 },
+	{ 0x1C, 0x36, 0x06, 0x0F, 0x06, 0x06, 0x0F, 0x00 },
+	{ 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x1F },
+	{ 0x07, 0x06, 0x36, 0x6E, 0x66, 0x66, 0x67, 0x00 },
+	{ 0x0C, 0x00, 0x0E, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },
+	{ 0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E },
+	{ 0x07, 0x06, 0x66, 0x36, 0x1E, 0x36, 0x67, 0x00 },
+	{ 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },
+	{ 0x00, 0x00, 0x33, 0x7F, 0x7F, 0x6B, 0x63, 0x00 },
+	{ 0x00, 0x00, 0x1F, 0x33, 0x33, 0x33, 0x33, 0x00 },
+	{ 0x00, 0x00, 0x1E, 0x33, 0x33, 0x33, 0x1E, 0x00 },
+	{ 0x00, 0x00, 0x3B, 0x66, 0x66, 0x3E, 0x06, 0x0F },
+	{ 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x78 },
+	{ 0x00, 0x00, 0x3B, 0x6E, 0x66, 0x06, 0x0F, 0x00 },
+	{ 0x00, 0x00, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x00 },
+	{ 0x08, 0x0C, 0x3E, 0x0C, 0x0C, 0x2C, 0x18, 0x00 },
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6E, 0x00 },
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },
+	{ 0x00, 0x00, 0x63, 0x6B, 0x7F, 0x7F, 0x36, 0x00 },
+	{ 0x00, 0x00, 0x63, 0x36, 0x1C, 0x36, 0x63, 0x00 },
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x3E, 0x30, 0x1F },
+	{ 0x00, 0x00, 0x3F, 0x19, 0x0C, 0x26, 0x3F, 0x00 },
+	{ 0x38, 0x0C, 0x0C, 0x07, 0x0C, 0x0C, 0x38, 0x00 },
+	{ 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00 },
+	{ 0x07, 0x0C, 0x0C, 0x38, 0x0C, 0x0C, 0x07, 0x00 },
+	{ 0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+};
+
+/*
+	Code page 437 box drawing, 0xB3 to 0xDA. Each arm from the center is 2 bits, 0 for none, 1 for a single
+	line and 2 for a double one: up in bits 0-1, down in 2-3, left in 4-5 and right in 6-7.
+*/
+#define EXPORT_BOX(up, down, left, right) ((up) | (down) << 2 | (left) << 4 | (right) << 6)
+static const uint8_t export_box[] =
+{
+	EXPORT_BOX(1, 1, 0, 0), EXPORT_BOX(1, 1, 1, 0), EXPORT_BOX(1, 1, 2, 0), EXPORT_BOX(2, 2, 1, 0),
+	EXPORT_BOX(0, 2, 1, 0), EXPORT_BOX(0, 1, 2, 0), EXPORT_BOX(2, 2, 2, 0), EXPORT_BOX(2, 2, 0, 0),
+	EXPORT_BOX(0, 2, 2, 0), EXPORT_BOX(2, 0, 2, 0), EXPORT_BOX(2, 0, 1, 0), EXPORT_BOX(1, 0, 2, 0),
+	EXPORT_BOX(0, 1, 1, 0), EXPORT_BOX(1, 0, 0, 1), EXPORT_BOX(1, 0, 1, 1), EXPORT_BOX(0, 1, 1, 1),
+	EXPORT_BOX(1, 1, 0, 1), EXPORT_BOX(0, 0, 1, 1), EXPORT_BOX(1, 1, 1, 1), EXPORT_BOX(1, 1, 0, 2),
+	EXPORT_BOX(2, 2, 0, 1), EXPORT_BOX(2, 0, 0, 2), EXPORT_BOX(0, 2, 0, 2), EXPORT_BOX(2, 0, 2, 2),
+	EXPORT_BOX(0, 2, 2, 2), EXPORT_BOX(2, 2, 0, 2), EXPORT_BOX(0, 0, 2, 2), EXPORT_BOX(2, 2, 2, 2),
+	EXPORT_BOX(1, 0, 2, 2), EXPORT_BOX(2, 0, 1, 1), EXPORT_BOX(0, 1, 2, 2), EXPORT_BOX(0, 2, 1, 1),
+	EXPORT_BOX(2, 0, 0, 1), EXPORT_BOX(1, 0, 0, 2), EXPORT_BOX(0, 1, 0, 2), EXPORT_BOX(0, 2, 0, 1),
+	EXPORT_BOX(2, 2, 1, 1), EXPORT_BOX(1, 1, 2, 2), EXPORT_BOX(1, 0, 1, 0), EXPORT_BOX(0, 1, 0, 1),
+};
+
+/*
+	The first thread to want a tile claims it and builds it in place, ready is set once it's done.
+	Threads that find a tile claimed but not ready build their own copy rather than wait.
+*/
+struct export_tiles
+{
+	const uint32_t* palette;
+	volatile int32_t claimed[EXPORT_TILE_COUNT];
+	volatile int32_t ready[EXPORT_TILE_COUNT];
+	uint8_t pixels[EXPORT_TILE_COUNT][EXPORT_TILE_BYTES];
+};
+
+struct export_cache
+{
+	uint8_t glyphs[256][EXPORT_GLYPH_SIZE];
+	int palette_count;
+	/* struct export_tiles* per palette, built when a sprite first needs it since each is megabytes */
+	volatile int64_t* tiles;
+};
+
+/* Lines for box drawing chars, single ones through the middle two pixels and double ones either side of them */
+static uint8_t export_box_line(int style)
+{
+	return style == 1 ? 0x18 : style == 2 ? 0x24 : 0;
+}
+
+static void export_build_box(uint8_t box, uint8_t* glyph)
+{
+	uint8_t up = export_box_line(box & 3), down = export_box_line(box >> 2 & 3);
+	uint8_t left = export_box_line(box >> 4 & 3), right = export_box_line(box >> 6 & 3);
+	for (int y = 0; y < EXPORT_GLYPH_SIZE; y++)
+	{
+		/* arms run from the edge to the far side of the center, so they always meet */
+		glyph[y] = (y <= 4 ? up : 0) | (y >= 3 ? down : 0);
+		if ((left | right) >> y & 1)
+		{
+			glyph[y] |= (left & 1 << y ? 0x1F : 0) | (right & 1 << y ? 0xF8 : 0);
+		}
+	}
+}
+
+/* The glyph a char is drawn with, anything the table doesn't cover is an empty box so it still shows up */
+static void export_build_glyph(unsigned char ch, uint8_t* glyph)
+{
+	for (int y = 0; y < EXPORT_GLYPH_SIZE; y++)
+	{
+		uint8_t checker = y & 1 ? 0xAA : 0x55;
+		switch (ch)
+		{
+		case 0:
+		case 0xFF:
+			glyph[y] = 0;
+			break;
+		case 0xB0:
+			glyph[y] = y & 1 ? 0 : 0x55;
+			break;
+		case 0xB1:
+			glyph[y] = checker;
+			break;
+		case 0xB2:
+			glyph[y] = y & 1 ? 0xFF : 0xAA;
+			break;
+		case 0xDB:
+			glyph[y] = 0xFF;
+			break;
+		case 0xDC:
+			glyph[y] = y >= EXPORT_GLYPH_SIZE / 2 ? 0xFF : 0;
+			break;
+		case 0xDD:
+			glyph[y] = 0x0F;
+			break;
+		case 0xDE:
+			glyph[y] = 0xF0;
+			break;
+		case 0xDF:
+			glyph[y] = y < EXPORT_GLYPH_SIZE / 2 ? 0xFF : 0;
+			break;
+		case 0xF9:
+		case 0xFA:
+			glyph[y] = y == 3 || y == 4 ? 0x18 : 0;
+			break;
+		case 0xFE:
+			glyph[y] = y >= 2 && y <= 5 ? 0x3C : 0;
+			break;
+		default:
+			if (ch >= ' ' && ch <= '~')
+			{
+				glyph[y] = export_font[ch - ' '][y];
+			}
+			else
+			{
+				glyph[y] = y == 1 || y == 6 ? 0x7E : y > 1 && y < 6 ? 0x42 : 0;
+			}
+			break;
+		}
+	}
+	if (ch >= 0xB3 && ch <= 0xDA)
+	{
+		export_build_box(export_box[ch - 0xB3], glyph);
+	}
+}
+
+export_cache_t export_cache_create(void)
+{
+	export_cache_t res = dig_malloc(sizeof * res);
+	for (int ch = 0; ch < 256; ch++)
+	{
+		export_build_glyph((unsigned char)ch, res->glyphs[ch]);
+	}
+	res->palette_count = screen_palette_count();
+	res->tiles = dig_malloc(res->palette_count * sizeof * res->tiles);
+	memset((void*)res->tiles, 0, res->palette_count * sizeof * res->tiles);
+	return res;
+}
+
+void export_cache_destroy(export_cache_t cache)
+{
+	if (!cache)
+	{
+		return;
+	}
+	for (int i = 0; i < cache->palette_count; i++)
+	{
+		free((void*)(intptr_t)cache->tiles[i]);
+	}
+	free((void*)cache->tiles);
+	free(cache);
+}
+
+static void export_rasterize(const uint8_t* glyph, uint32_t foreground, uint32_t background, uint8_t* out)
+{
+	for (int y = 0; y < EXPORT_GLYPH_SIZE; y++)
+	{
+		for (int x = 0; x < EXPORT_GLYPH_SIZE; x++, out += 3)
+		{
+			uint32_t color = glyph[y] >> x & 1 ? foreground : background;
+			out[0] = (uint8_t)(color >> 16);
+			out[1] = (uint8_t)(color >> 8);
+			out[2] = (uint8_t)color;
+		}
+	}
+}
+
+/* Returns the tile for a char in an attribute's colors, spare is used when another thread is still building it */
+static const uint8_t* export_tile(export_cache_t cache, struct export_tiles* tiles, unsigned char ch, uint8_t colors, uint8_t* spare)
+{
+	int key = ch << 8 | colors;
+	if (atomic_load32(&tiles->ready[key]))
+	{
+		return tiles->pixels[key];
+	}
+	uint8_t* out = atomic_add32(&tiles->claimed[key], 1) == 1 ? tiles->pixels[key] : spare;
+	export_rasterize(cache->glyphs[ch], tiles->palette[colors & 0xF], tiles->palette[colors >> 4], out);
+	if (out != spare)
+	{
+		atomic_store32(&tiles->ready[key], 1);
+	}
+	return out;
+}
+
+/* A palette's tiles, the first thread to need them publishes its table and any that raced it throw theirs away */
+static struct export_tiles* export_palette_tiles(export_cache_t cache, int palette)
+{
+	struct export_tiles* res = (struct export_tiles*)(intptr_t)atomic_load64(&cache->tiles[palette]);
+	if (res)
+	{
+		return res;
+	}
+	/* only the flags are cleared, the pixels are written before they're ever read */
+	struct export_tiles* built = dig_malloc(sizeof * built);
+	built->palette = screen_palette(palette);
+	memset((void*)built->claimed, 0, sizeof built->claimed);
+	memset((void*)built->ready, 0, sizeof built->ready);
+	int64_t seen = atomic_cas64(&cache->tiles[palette], 0, (int64_t)(intptr_t)built);
+	if (seen)
+	{
+		free(built);
+		return (struct export_tiles*)(intptr_t)seen;
+	}
+	return built;
+}
+
+bool export_sprite_ppm(export_cache_t cache, sprite_t sprite, const char* output)
+{
+	int width = screen_sprite_width(sprite), height = screen_sprite_height(sprite);
+	int palette = screen_sprite_palette(sprite);
+	struct export_tiles* tiles = export_palette_tiles(cache, palette >= 0 && palette < cache->palette_count ? palette : SCREEN_DEFAULT_PALETTE);
+	const uint8_t* transparency = screen_sprite_transparency(sprite);
+
+	FILE* handle = fopen(output, "wb");
+	if (!handle)
+	{
+		log_error("Failed to create \"%s\"\n", output);
+		return false;
+	}
+
+	/* a row of cells at a time, written out as EXPORT_GLYPH_SIZE rows of pixels */
+	arena_t scratch = arena_scratch();
+	char* text = arena_alloc(scratch, width * sizeof * text);
+	attribute_t* attrib = arena_alloc(scratch, width * sizeof * attrib);
+	size_t stride = (size_t)width * EXPORT_GLYPH_SIZE * 3;
+	uint8_t* pixels = arena_alloc(scratch, stride * EXPORT_GLYPH_SIZE);
+	uint8_t spare[EXPORT_TILE_BYTES];
+
+	bool ok = fprintf(handle, "P6\n%i %i\n255\n", width * EXPORT_GLYPH_SIZE, height * EXPORT_GLYPH_SIZE) > 0;
+	for (int y = 0; y < height && ok; y++)
+	{
+		screen_sprite_read_row(sprite, 0, y, text, attrib);
+		for (int x = 0; x < width; x++)
+		{
+			bool is_hidden = transparency && transparency[(size_t)y * width + x];
+			const uint8_t* tile = export_tile(cache, tiles, is_hidden ? 0 : (unsigned char)text[x], is_hidden ? 0 : (uint8_t)attrib[x], spare);
+			for (int row = 0; row < EXPORT_GLYPH_SIZE; row++)
+			{
+				memcpy(pixels + row * stride + (size_t)x * EXPORT_GLYPH_SIZE * 3, tile + row * EXPORT_GLYPH_SIZE * 3, EXPORT_GLYPH_SIZE * 3);
+			}
+		}
+		ok = fwrite(pixels, 1, stride * EXPORT_GLYPH_SIZE, handle) == stride * EXPORT_GLYPH_SIZE;
+	}
+	ok = fclose(handle) == 0 && ok;
+	arena_reset(scratch);
+	if (!ok)
+	{
+		log_error("Failed to write \"%s\"\n", output);
+		remove(output);
+	}
+	return ok;
+}
\ No newline at end of file
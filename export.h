@@ -0,0 +1,20 @@
+/*
+	export.h ~ RL
+
+	Renders sprites to images outside of the console, one TARGET_CELL_SIZE square of pixels per cell.
+*/
+
+#pragma once
+
+#include "types.h"
+
+/*
+	Rasterized glyph and attribute tiles for every palette, built the first time each is drawn and reused after.
+	One cache is meant to be shared by every thread exporting at once.
+*/
+typedef struct export_cache* export_cache_t;
+
+export_cache_t export_cache_create(void);
+void export_cache_destroy(export_cache_t cache);
+/* Writes the first frame of sprite to output as a binary PPM in the sprite's palette. Transparent cells come out black. */
+bool export_sprite_ppm(export_cache_t cache, sprite_t sprite, const char* output);
\ No newline at end of file
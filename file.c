@@ -3,19 +3,41 @@
 */
 
 #include "file.h"
-#include "debug.h"
+#include "arena.h"
+#include "cache.h"
+#include "log.h"
 #include <math.h>
+#include "profile.h"
 #include "screen.h"
+#include "thread.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define FILE_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef _WIN32
+#include <Windows.h>
+#include <intrin.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #define DATA_STRING_MAX_SIZE 16
+/* 65535 is the largest value any plane accepts, leading zeros aside */
+#define ROW_VALUE_MAX_DIGITS 5
+/* block size of the arena behind a standalone file_index_open */
+#define FILE_INDEX_ARENA_SIZE 4096
 
-#define _UNEXPECTED_TOKEN_MESSAGE(file, tok, etype) debug_format("(%i) Unexpected token %i, expected %i at line %i, col %i\n", __LINE__, tok.type, etype, (file)->line, (file)->col);
+#define _UNEXPECTED_TOKEN_MESSAGE(file, tok, etype) log_error("(%i) Unexpected token %i, expected %i at line %i, col %i\n", __LINE__, tok.type, etype, (file)->line, file_column(file));
 #define MATCH_AND_ADVANCE_TOKEN(file, tok, etype) if (tok.type != (etype)) { _UNEXPECTED_TOKEN_MESSAGE(file, tok, etype); goto cleanup; } else { file_next(file, &tok); }
 #define MATCH_TOKEN(file, tok, etype) if (tok.type != (etype)) { _UNEXPECTED_TOKEN_MESSAGE(file, tok, etype); goto cleanup; }
-#define ENSURE_CONDITION(file, cond) if (!(cond)) { debug_format("(%i) Failed condition " #cond " at line %i, col %i\n", __LINE__, (file)->line, (file)->col); goto cleanup; }
+#define ENSURE_CONDITION(file, cond) if (!(cond)) { log_error("(%i) Failed condition " #cond " at line %i, col %i\n", __LINE__, (file)->line, file_column(file)); goto cleanup; }
 
 enum token_type
 {
@@ -27,11 +49,16 @@ enum token_type
 	TOKEN_DECIMAL
 };
 
+/* The whole file is mapped and scanned in place, CRLF pairs are read as a single '\n' */
 struct file
 {
-	FILE* handle;
+	file_view_t view;
+	/* false when the view belongs to someone else, like a pack */
+	bool owns_view;
+	const char* cursor;
+	const char* end;
+	const char* line_start;
 	int line;
-	int col;
 };
 
 struct token
@@ -45,33 +72,415 @@ struct token
 	} data;
 };
 
-static inline int file_fpeek(struct file* file)
+#ifdef _WIN32
+static uint64_t file_time_to_u64(FILETIME time)
 {
-	int ch = fgetc(file->handle);
-	ungetc(ch, file->handle);
-	return ch;
+	return (uint64_t)time.dwHighDateTime << 32 | time.dwLowDateTime;
+}
+#endif
+
+bool file_stat(const char* path, uint64_t* mtime, uint64_t* size)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data))
+	{
+		return false;
+	}
+	*mtime = file_time_to_u64(data.ftLastWriteTime);
+	*size = (uint64_t)data.nFileSizeHigh << 32 | data.nFileSizeLow;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0)
+	{
+		return false;
+	}
+	*mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	*size = st.st_size;
+#endif
+	return true;
+}
+
+bool file_map(const char* path, file_view_t* out)
+{
+	memset(out, 0, sizeof * out);
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	BY_HANDLE_FILE_INFORMATION info;
+	if (!GetFileInformationByHandle(handle, &info))
+	{
+		CloseHandle(handle);
+		return false;
+	}
+	out->size = (size_t)((uint64_t)info.nFileSizeHigh << 32 | info.nFileSizeLow);
+	out->mtime = file_time_to_u64(info.ftLastWriteTime);
+	if (out->size > 0)
+	{
+		/* the mapping keeps the file open, so the handle can go right away */
+		out->mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+		out->data = out->mapping ? MapViewOfFile(out->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+		if (!out->data)
+		{
+			if (out->mapping)
+			{
+				CloseHandle(out->mapping);
+			}
+			CloseHandle(handle);
+			return false;
+		}
+	}
+	CloseHandle(handle);
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return false;
+	}
+	out->size = st.st_size;
+	out->mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	if (out->size > 0)
+	{
+		void* view = mmap(NULL, out->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (view == MAP_FAILED)
+		{
+			close(fd);
+			return false;
+		}
+		madvise(view, out->size, MADV_SEQUENTIAL);
+		out->data = view;
+	}
+	close(fd);
+#endif
+	return true;
+}
+
+bool file_read(const char* path, file_view_t* out)
+{
+	memset(out, 0, sizeof * out);
+	out->is_copy = true;
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	BY_HANDLE_FILE_INFORMATION info;
+	if (!GetFileInformationByHandle(handle, &info))
+	{
+		CloseHandle(handle);
+		return false;
+	}
+	size_t capacity = (size_t)((uint64_t)info.nFileSizeHigh << 32 | info.nFileSizeLow);
+	out->mtime = file_time_to_u64(info.ftLastWriteTime);
+	char* data = dig_malloc(capacity ? capacity : 1);
+	/* a file cut short while it's read just ends early, the parser reports what's missing */
+	DWORD size;
+	while (out->size < capacity && ReadFile(handle, data + out->size, (DWORD)(capacity - out->size < 0x40000000 ? capacity - out->size : 0x40000000), &size, NULL) && size > 0)
+	{
+		out->size += size;
+	}
+	CloseHandle(handle);
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return false;
+	}
+	size_t capacity = st.st_size;
+	out->mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	char* data = dig_malloc(capacity ? capacity : 1);
+	/* a file cut short while it's read just ends early, the parser reports what's missing */
+	while (out->size < capacity)
+	{
+		ssize_t size = read(fd, data + out->size, capacity - out->size);
+		if (size < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (size <= 0)
+		{
+			break;
+		}
+		out->size += size;
+	}
+	close(fd);
+#endif
+	out->data = data;
+	return true;
+}
+
+void file_unmap(file_view_t* view)
+{
+	if (!view->data)
+	{
+		return;
+	}
+	if (view->is_copy)
+	{
+		free((void*)view->data);
+		view->data = NULL;
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(view->data);
+	CloseHandle(view->mapping);
+#else
+	munmap((void*)view->data, view->size);
+#endif
+	view->data = NULL;
+}
+
+/* Maps directory, or reads from view without taking ownership of it when view isn't NULL */
+static bool file_open(struct file* file, const char* directory, const file_view_t* view)
+{
+	file->owns_view = !view;
+	if (view)
+	{
+		file->view = *view;
+	}
+	else if (!file_map(directory, &file->view))
+	{
+		return false;
+	}
+	file->cursor = file->line_start = file->view.data;
+	file->end = file->view.data + file->view.size;
+	file->line = 0;
+	return true;
+}
+
+static void file_close(struct file* file)
+{
+	if (file->owns_view)
+	{
+		file_unmap(&file->view);
+	}
+}
+
+static inline int file_column(const struct file* file)
+{
+	return (int)(file->cursor - file->line_start);
+}
+
+static inline int file_fpeek(const struct file* file)
+{
+	const char* p = file->cursor;
+	if (p >= file->end)
+	{
+		return EOF;
+	}
+	if (*p == '\r' && p + 1 < file->end && p[1] == '\n')
+	{
+		return '\n';
+	}
+	return (unsigned char)*p;
 }
 
 static inline int file_fgetc(struct file* file)
 {
-	int ch = fgetc(file->handle);
-	file->col++;
+	int ch = file_fpeek(file);
+	if (ch == EOF)
+	{
+		return EOF;
+	}
+	file->cursor += ch == '\n' && *file->cursor == '\r' ? 2 : 1;
 	if (ch == '\n')
 	{
 		file->line++;
-		file->col = 0;
+		file->line_start = file->cursor;
 	}
 	return ch;
 }
 
+/* Consumes a run of digits in place, returning its value */
+static inline int file_scan_digits(struct file* file, int* len)
+{
+	const char* p = file->cursor;
+	const char* end = file->end;
+	int num = 0;
+	while (p < end && (unsigned)(*p - '0') < 10)
+	{
+		num = num * 10 + *p++ - '0';
+	}
+	*len = (int)(p - file->cursor);
+	file->cursor = p;
+	return num;
+}
+
+static inline int file_ctz(uint32_t x)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, x);
+	return (int)index;
+#else
+	return __builtin_ctz(x);
+#endif
+}
+
+/*
+	Classifies up to 16 bytes at p, setting bit i of digits/spaces if p[i] is a digit/space.
+	Returns how many bytes were classified, bytes past the end of the file are neither.
+*/
+static inline int file_classify(const char* p, const char* end, uint32_t* digits, uint32_t* spaces)
+{
+	int available = end - p < 16 ? (int)(end - p) : 16;
+#ifdef FILE_SSE2
+	if (available == 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		__m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+		*digits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d));
+		*spaces = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+		return available;
+	}
+#endif
+	*digits = *spaces = 0;
+	for (int i = 0; i < available; i++)
+	{
+		*digits |= (uint32_t)((unsigned)(p[i] - '0') < 10) << i;
+		*spaces |= (uint32_t)(p[i] == ' ') << i;
+	}
+	return available;
+}
+
+static bool file_row_error(struct file* file, const char* at, const char* what)
+{
+	file->cursor = at;
+	log_error("%s at line %i, col %i\n", what, file->line, file_column(file));
+	return false;
+}
+
+/*
+	Decodes one row of width space separated integers, newline included, into out.
+	Separators are found 16 bytes at a time and every value is range checked against max once the row is done.
+*/
+static bool file_decode_row(struct file* file, int width, int max, attribute_t* out)
+{
+	const char* p = file->cursor;
+	const char* end = file->end;
+	int count = 0;
+	int largest = 0;
+	while (count < width)
+	{
+		uint32_t digits, spaces;
+		int available = file_classify(p, end, &digits, &spaces);
+		if (available == 0)
+		{
+			return file_row_error(file, p, "Row ends early");
+		}
+
+		int i = 0;
+		while (i < available && count < width)
+		{
+			if (spaces >> i & 1)
+			{
+				i += file_ctz(~(spaces >> i));
+				continue;
+			}
+			if (!(digits >> i & 1))
+			{
+				return file_row_error(file, p + i, "Unexpected character in row");
+			}
+			int run = file_ctz(~(digits >> i));
+			if (i + run == available && p + available < end)
+			{
+				/* the number may carry on into the next chunk, the rest of it is found one char at a time */
+				while (p + i + run < end && (unsigned)(p[i + run] - '0') < 10)
+				{
+					run++;
+				}
+			}
+			/* zero padded values are fine, only significant digits count against the limit */
+			int zeros = 0;
+			while (zeros < run - 1 && p[i + zeros] == '0')
+			{
+				zeros++;
+			}
+			if (run - zeros > ROW_VALUE_MAX_DIGITS)
+			{
+				return file_row_error(file, p + i, "Value out of range");
+			}
+			int value = 0;
+			for (const char* digit = p + i + zeros; digit < p + i + run; digit++)
+			{
+				value = value * 10 + *digit - '0';
+			}
+			largest = value > largest ? value : largest;
+			out[count++] = (attribute_t)value;
+			i += run;
+		}
+		p += i;
+	}
+
+	while (p < end && *p == ' ')
+	{
+		p++;
+	}
+	if (p < end)
+	{
+		if (*p == '\r' && p + 1 < end && p[1] == '\n')
+		{
+			p++;
+		}
+		if (*p != '\n')
+		{
+			return file_row_error(file, p, "Row is too long");
+		}
+		p++;
+	}
+
+	if (largest > max)
+	{
+		/* slow path, find the first value that was out of range for the error */
+		const char* at = file->cursor;
+		for (int x = 0; x < width; x++)
+		{
+			while (*at == ' ')
+			{
+				at++;
+			}
+			int value = 0;
+			const char* start = at;
+			while ((unsigned)(*at - '0') < 10)
+			{
+				value = value * 10 + *at++ - '0';
+			}
+			if (value > max)
+			{
+				return file_row_error(file, start, "Value out of range");
+			}
+		}
+	}
+
+	file->cursor = file->line_start = p;
+	file->line++;
+	return true;
+}
+
 static bool file_next(struct file* file, struct token* out)
 {
-	int ch = file_fpeek(file);
 	memset(out, 0, sizeof * out);
-	while (ch == ' ')
+	while (file->cursor < file->end && *file->cursor == ' ')
 	{
-		ch = file_fgetc(file);
+		file->cursor++;
 	}
+	int ch = file_fpeek(file);
 
 	if (ch == '#')
 	{
@@ -90,47 +499,46 @@ static bool file_next(struct file* file, struct token* out)
 	}
 	else if (ch >= '0' && ch <= '9')
 	{
+		int len;
 		out->type = TOKEN_INTEGER;
-		int num = 0;
-		ch = file_fgetc(file);
-		while (ch >= '0' && ch <= '9')
-		{
-			num = num * 10 + ch - '0';
-			ch = file_fgetc(file);
-		}
+		int num = file_scan_digits(file, &len);
 		out->data.integer = num;
+		/* the character terminating a number is consumed along with it */
+		ch = file_fgetc(file);
 		if (ch != '.')
 		{
 			return true;
 		}
-		ch = file_fgetc(file);
-		int dec = 0, len = 0;
 		out->type = TOKEN_DECIMAL;
-		while (ch >= '0' && ch <= '9')
-		{
-			dec = dec * 10 + ch - '0';
-			len++;
-			ch = file_fgetc(file);
-		}
+		int dec = file_scan_digits(file, &len);
+		file_fgetc(file);
 		out->data.decimal = (float)num + powf(10, -(float)len) * dec;
 	}
 	else if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z'))
 	{
 		out->type = TOKEN_STRING;
-		int i;
-		for (i = 0; file_fpeek(file) != '\n' && file_fpeek(file) != EOF && i < DATA_STRING_MAX_SIZE - 1; i++)
+		size_t remaining = file->end - file->cursor;
+		const char* line_end = memchr(file->cursor, '\n', remaining);
+		size_t len = line_end ? (size_t)(line_end - file->cursor) : remaining;
+		if (len > 0 && file->cursor[len - 1] == '\r' && line_end)
 		{
-			ch = file_fgetc(file);
-			out->data.str[i] = ch;
+			len--;
 		}
-		if (i >= DATA_STRING_MAX_SIZE)
+		if (len >= DATA_STRING_MAX_SIZE)
 		{
-			debug_format("String \"%s\" read hits max size\n", out->data.str[i]);
+			len = DATA_STRING_MAX_SIZE - 1;
+			memcpy(out->data.str, file->cursor, len);
+			log_error("String \"%s\" read hits max size\n", out->data.str);
 		}
+		else
+		{
+			memcpy(out->data.str, file->cursor, len);
+		}
+		file->cursor += len;
 	}
 	else
 	{
-		debug_format("Error reading file, unexpected character '%c' or 0x%.02X\n", ch, ch);
+		log_error("Error reading file, unexpected character '%c' or 0x%.02X\n", ch, ch);
 		return false;
 	}
 
@@ -142,154 +550,505 @@ static void file_serialize_and_print_token(struct token* token)
 	switch (token->type)
 	{
 	case TOKEN_HASHTAG:
-		debug_format("Hashtag\n");
+		log_debug("Hashtag\n");
 		break;
 	case TOKEN_NEWLINE:
-		debug_format("Newline\n");
+		log_debug("Newline\n");
 		break;
 	case TOKEN_EOF:
-		debug_format("EOF\n");
+		log_debug("EOF\n");
 		break;
 	case TOKEN_STRING:
-		debug_format("String \"%s\"\n", token->data.str);
+		log_debug("String \"%s\"\n", token->data.str);
 		break;
 	case TOKEN_INTEGER:
-		debug_format("Integer %i\n", token->data.integer);
+		log_debug("Integer %i\n", token->data.integer);
 		break;
 	case TOKEN_DECIMAL:
-		debug_format("Decimal %f\n", token->data.decimal);
+		log_debug("Decimal %f\n", token->data.decimal);
 		break;
 	}
 }
 
-sprite_t file_load_sprite(const char* directory)
+/*
+	"Width" - one number
+	"Height" - one number
+	"Image" - 2-D array of characters with size WidthXHeight
+	"Color" - 2-D array of attributes with size WidthXHeight
+	"TileType" - 2-D array of unknown type with size WidthXHeight
+	"X weather" - Two integers and one decimal number, determining what weather effects to show
+	"PaletteColor" - Number to identify which color palette the console will render it with.
+	"Transparency" - 2-D array of unknown type with size WidthXHeight
+	"Z" - Unknown purpose, but both in-game sprites have multiple image and color headings and are for the scientist.
+
+	Every type is one line below: kind, header, its first and last characters, whether it repeats per frame,
+	and the decoder that writes it into the sprite. The enum, registry and lookup are all generated from it.
+*/
+#define FILE_SECTION_TYPES(X) \
+	X(WIDTH, "Width", 'W', 'h', false, NULL) \
+	X(HEIGHT, "Height", 'H', 't', false, NULL) \
+	X(IMAGE, "Image", 'I', 'e', true, file_decode_image) \
+	X(COLOR, "Color", 'C', 'r', true, file_decode_color) \
+	X(TILE_TYPE, "TileType", 'T', 'e', false, file_decode_tile_type) \
+	X(X_WEATHER, "X weather", 'X', 'r', false, NULL) \
+	X(PALETTE_COLOR, "PaletteColor", 'P', 'r', false, file_decode_palette) \
+	X(TRANSPARENCY, "Transparency", 'T', 'y', false, file_decode_transparency) \
+	X(Z, "Z", 'Z', 'Z', false, NULL)
+
+/*
+	Perfect over the names above, from a header's length and its first and last characters. It's checked
+	when compiling: two names that collide are duplicate cases in file_section_kind.
+*/
+#define FILE_SECTION_HASH(length, first, last) ((((length) << 2) + (first) + (last)) & 31)
+
+enum file_section_kind
+{
+	FILE_SECTION_UNKNOWN = -1,
+#define FILE_SECTION_KIND(kind, name, first, last, is_per_frame, decode) FILE_SECTION_##kind,
+	FILE_SECTION_TYPES(FILE_SECTION_KIND)
+#undef FILE_SECTION_KIND
+	FILE_SECTION_TYPE_COUNT
+};
+
+struct file_section
+{
+	char name[DATA_STRING_MAX_SIZE];
+	enum file_section_kind kind;
+	/* body runs from the line after the header up to the next header */
+	const char* begin;
+	const char* end;
+	int line;
+};
+
+struct file_index
+{
+	struct file file;
+	arena_t arena;
+	bool owns_arena;
+	int width, height;
+	int count, capacity;
+	struct file_section* sections;
+	/* how many sections of each kind there are, and where the first one is */
+	int kind_counts[FILE_SECTION_TYPE_COUNT];
+	int kind_first[FILE_SECTION_TYPE_COUNT];
+};
+
+/* What the decoders fill in, the frame planes are sized from the index's counts before any of them run */
+struct file_sprite_build
+{
+	sprite_data_t data;
+	/* frames decoded so far */
+	int images, colors;
+	/* one plane of wide values, Image and the byte planes are decoded through it then narrowed */
+	attribute_t* row;
+	char* text;
+	attribute_t* color;
+	uint8_t* planes;
+};
+
+typedef bool (*file_section_decode_t)(file_index_t index, int section, struct file_sprite_build* build);
+
+/* Points file at just the body of a section, so the tokenizer and row decoder stop at its end */
+static void file_index_section_file(file_index_t index, int section, struct file* out)
+{
+	*out = index->file;
+	out->cursor = out->line_start = index->sections[section].begin;
+	out->end = index->sections[section].end;
+	out->line = index->sections[section].line;
+}
+
+/* Reads a section whose body is a single integer */
+static bool file_index_read_integer(file_index_t index, int section, int* out)
 {
 	struct file file;
 	struct file* pfile = &file;
-	file.line = file.col = 0;
-	file.handle = fopen(directory, "r");
-	if (!file.handle)
+	file_index_section_file(index, section, pfile);
+
+	struct token curr;
+	file_next(pfile, &curr);
+	ENSURE_CONDITION(pfile, curr.type == TOKEN_INTEGER);
+	*out = curr.data.integer;
+	return true;
+cleanup:
+	return false;
+}
+
+bool file_index_read_plane(file_index_t index, int section, int max, attribute_t* out)
+{
+	uint64_t start = profile_begin();
+	bool res = false;
+	struct file file;
+	struct file* pfile = &file;
+	file_index_section_file(index, section, pfile);
+
+	for (int y = 0; y < index->height; y++)
 	{
-		debug_format("File \"%s\" does not exist\n", directory);
-		return NULL;
+		ENSURE_CONDITION(pfile, file_decode_row(pfile, index->width, max, out + y * index->width));
+	}
+	ENSURE_CONDITION(pfile, pfile->cursor == pfile->end);
+	res = true;
+cleanup:
+	profile_end(PROFILE_DECODE, start);
+	return res;
+}
+
+/* Decodes a plane whose values fit in a byte, through the wide row scratch buffer */
+static bool file_index_read_byte_plane(file_index_t index, int section, attribute_t* row, uint8_t* out)
+{
+	if (!file_index_read_plane(index, section, 0xFF, row))
+	{
+		return false;
+	}
+	for (int i = 0; i < index->width * index->height; i++)
+	{
+		out[i] = (uint8_t)row[i];
+	}
+	return true;
+}
+
+static bool file_decode_image(file_index_t index, int section, struct file_sprite_build* build)
+{
+	size_t cells = (size_t)index->width * index->height;
+	char* text = build->text + build->images++ * cells;
+	if (!file_index_read_plane(index, section, 0xFF, build->row))
+	{
+		return false;
+	}
+	for (size_t i = 0; i < cells; i++)
+	{
+		text[i] = (char)build->row[i];
 	}
+	return true;
+}
+
+static bool file_decode_color(file_index_t index, int section, struct file_sprite_build* build)
+{
+	size_t cells = (size_t)index->width * index->height;
+	return file_index_read_plane(index, section, 0xFFFF, build->color + build->colors++ * cells);
+}
 
-	/*
-		"Width" - one number
-		"Height" - one number
-		"Image" - 2-D array of characters with size WidthXHeight
-		"Color" - 2-D array of attributes with size WidthXHeight
-		"TileType" - 2-D array of unknown type with size WidthXHeight
-		"X weather" - Two integers and one decimal number, determining what weather effects to show
-		"PaletteColor" - Number to identify which color palette the console will render it with.
-		"Transparency" - 2-D array of unknown type with size WidthXHeight
-		"Z" - Unknown purpose, but both in-game sprites have multiple image and color headings and are for the scientist.
-	*/
+static bool file_decode_palette(file_index_t index, int section, struct file_sprite_build* build)
+{
+	return file_index_read_integer(index, section, &build->data.palette);
+}
 
-	int width = 0, height = 0;
-	char* text = NULL;
-	attribute_t* color = NULL;
+static bool file_decode_transparency(file_index_t index, int section, struct file_sprite_build* build)
+{
+	build->data.transparency = build->planes;
+	return file_index_read_byte_plane(index, section, build->row, build->planes);
+}
 
-	struct token curr;
-	file_next(pfile, &curr);
-	while (curr.type != TOKEN_EOF)
+static bool file_decode_tile_type(file_index_t index, int section, struct file_sprite_build* build)
+{
+	uint8_t* out = build->planes + (size_t)index->width * index->height;
+	build->data.tile_type = out;
+	return file_index_read_byte_plane(index, section, build->row, out);
+}
+
+struct file_section_type
+{
+	const char* name;
+	size_t length;
+	/* Image and Color repeat once per frame, only the first of any other section is decoded */
+	bool is_per_frame;
+	/* NULL for sections that are read while indexing, or skipped without being read */
+	file_section_decode_t decode;
+};
+
+static const struct file_section_type file_section_types[FILE_SECTION_TYPE_COUNT] =
+{
+#define FILE_SECTION_TYPE(kind, name, first, last, is_per_frame, decode) { name, sizeof name - 1, is_per_frame, decode },
+	FILE_SECTION_TYPES(FILE_SECTION_TYPE)
+#undef FILE_SECTION_TYPE
+};
+
+/* One hash, one jump and one compare, however many section types there are */
+static enum file_section_kind file_section_kind(const char* name, size_t length)
+{
+	if (length == 0)
 	{
-		MATCH_AND_ADVANCE_TOKEN(pfile, curr, TOKEN_HASHTAG);
-		MATCH_TOKEN(pfile, curr, TOKEN_STRING);
-		if (strncmp(curr.data.str, "Width", DATA_STRING_MAX_SIZE) == 0)
-		{
-			file_next(pfile, &curr);
-			MATCH_AND_ADVANCE_TOKEN(pfile, curr, TOKEN_NEWLINE);
+		return FILE_SECTION_UNKNOWN;
+	}
+	enum file_section_kind res;
+	switch (FILE_SECTION_HASH(length, (unsigned char)name[0], (unsigned char)name[length - 1]))
+	{
+#define FILE_SECTION_CASE(kind, name, first, last, is_per_frame, decode) case FILE_SECTION_HASH(sizeof name - 1, first, last): res = FILE_SECTION_##kind; break;
+	FILE_SECTION_TYPES(FILE_SECTION_CASE)
+#undef FILE_SECTION_CASE
+	default:
+		return FILE_SECTION_UNKNOWN;
+	}
+	return length == file_section_types[res].length && memcmp(name, file_section_types[res].name, length) == 0 ? res : FILE_SECTION_UNKNOWN;
+}
 
-			ENSURE_CONDITION(pfile, curr.type == TOKEN_INTEGER);
-			width = curr.data.integer;
-			MATCH_AND_ADVANCE_TOKEN(pfile, curr, TOKEN_INTEGER);
-		}
-		else if (strncmp(curr.data.str, "Height", DATA_STRING_MAX_SIZE) == 0)
+static void file_index_push(file_index_t index, const char* header, const char* line_end, int line)
+{
+	if (index->count == index->capacity)
+	{
+		index->capacity = index->capacity ? index->capacity * 2 : 16;
+		struct file_section* sections = arena_alloc(index->arena, index->capacity * sizeof * sections);
+		if (index->count)
 		{
-			file_next(pfile, &curr);
-			MATCH_AND_ADVANCE_TOKEN(pfile, curr, TOKEN_NEWLINE);
-
-			ENSURE_CONDITION(pfile, curr.type == TOKEN_INTEGER);
-			height = curr.data.integer;
-			MATCH_AND_ADVANCE_TOKEN(pfile, curr, TOKEN_INTEGER);
+			memcpy(sections, index->sections, index->count * sizeof * sections);
 		}
-		else if (strncmp(curr.data.str, "Image", DATA_STRING_MAX_SIZE) == 0)
-		{
-			file_next(pfile, &curr);
-			MATCH_AND_ADVANCE_TOKEN(pfile, curr, TOKEN_NEWLINE);
+		index->sections = sections;
+	}
 
-			ENSURE_CONDITION(pfile, width != 0 && height != 0);
+	struct file_section* section = &index->sections[index->count++];
+	size_t len = line_end - header;
+	if (len > 0 && header[len - 1] == '\r')
+	{
+		len--;
+	}
+	len = len < DATA_STRING_MAX_SIZE - 1 ? len : DATA_STRING_MAX_SIZE - 1;
+	memcpy(section->name, header, len);
+	section->name[len] = '\0';
+	section->kind = file_section_kind(section->name, len);
+	if (section->kind != FILE_SECTION_UNKNOWN && index->kind_counts[section->kind]++ == 0)
+	{
+		index->kind_first[section->kind] = index->count - 1;
+	}
+	section->begin = line_end < index->file.end ? line_end + 1 : line_end;
+	section->line = line + 1;
+}
 
-			text = dig_malloc(width * height * sizeof * text);
-			char* curr_text = text;
+/*
+	One pass over the file that records where every "#Header" section starts and ends.
+	Headers are only ever at the start of a line, so this is a memchr from newline to newline.
+*/
+static file_index_t file_index_build(const char* directory, const file_view_t* view, arena_t arena, file_status_t* status)
+{
+	file_index_t res = arena_alloc(arena, sizeof * res);
+	memset(res, 0, sizeof * res);
+	res->arena = arena;
+	if (!file_open(&res->file, directory, view))
+	{
+		log_error("File \"%s\" does not exist\n", directory);
+		*status = FILE_STATUS_MISSING;
+		return NULL;
+	}
 
-			for (int y = 0; y < height; y++)
+	*status = FILE_STATUS_MALFORMED;
+	const char* p = res->file.view.data;
+	const char* end = res->file.end;
+	int line = 0;
+	if (p < end && *p != '#')
+	{
+		log_error("Expected a header at line 0, col 0\n");
+		goto cleanup;
+	}
+	while (p < end)
+	{
+		const char* line_end = memchr(p, '\n', end - p);
+		line_end = line_end ? line_end : end;
+		if (*p == '#')
+		{
+			if (res->count > 0)
 			{
-				MATCH_TOKEN(pfile, curr, TOKEN_INTEGER);
-				for (int x = 0; x < width; x++)
-				{
-					ENSURE_CONDITION(pfile, (curr.data.integer & 0xFFFFFF00) == 0);
-					*curr_text++ = curr.data.integer;
-					MATCH_AND_ADVANCE_TOKEN(pfile, curr, TOKEN_INTEGER);
-				}
-				MATCH_AND_ADVANCE_TOKEN(pfile, curr, TOKEN_NEWLINE);
+				res->sections[res->count - 1].end = p;
 			}
+			file_index_push(res, p + 1, line_end, line);
 		}
-		else if (strncmp(curr.data.str, "Color", DATA_STRING_MAX_SIZE) == 0)
+		p = line_end + 1;
+		line++;
+	}
+	if (res->count > 0)
+	{
+		res->sections[res->count - 1].end = end;
+	}
+
+	for (int i = 0; i < res->count; i++)
+	{
+		if (res->sections[i].kind == FILE_SECTION_UNKNOWN)
 		{
-			file_next(pfile, &curr);
-			MATCH_AND_ADVANCE_TOKEN(pfile, curr, TOKEN_NEWLINE);
+			log_error("Invalid sprite header \"%s\" at line %i\n", res->sections[i].name, res->sections[i].line - 1);
+			goto cleanup;
+		}
+	}
 
-			ENSURE_CONDITION(pfile, width != 0 && height != 0);
+	if (!res->kind_counts[FILE_SECTION_WIDTH] || !res->kind_counts[FILE_SECTION_HEIGHT]
+		|| !file_index_read_integer(res, res->kind_first[FILE_SECTION_WIDTH], &res->width)
+		|| !file_index_read_integer(res, res->kind_first[FILE_SECTION_HEIGHT], &res->height)
+		|| res->width <= 0 || res->height <= 0)
+	{
+		log_error("Sprite \"%s\" has no valid Width and Height\n", directory);
+		goto cleanup;
+	}
 
-			color = dig_malloc(width * height * sizeof * color);
-			attribute_t* curr_color = color;
+	*status = FILE_STATUS_OK;
+	return res;
+cleanup:
+	file_index_close(res);
+	return NULL;
+}
 
-			for (int y = 0; y < height; y++)
-			{
-				MATCH_TOKEN(pfile, curr, TOKEN_INTEGER);
-				for (int x = 0; x < width; x++)
-				{
-					ENSURE_CONDITION(pfile, (curr.data.integer & 0xFFFF0000) == 0);
-					*curr_color++ = curr.data.integer;
-					MATCH_AND_ADVANCE_TOKEN(pfile, curr, TOKEN_INTEGER);
-				}
-				MATCH_AND_ADVANCE_TOKEN(pfile, curr, TOKEN_NEWLINE);
-			}
-		}
-		else if (strncmp(curr.data.str, "PaletteColor", DATA_STRING_MAX_SIZE) == 0)
+file_index_t file_index_open(const char* directory)
+{
+	file_status_t status;
+	arena_t arena = arena_create(FILE_INDEX_ARENA_SIZE, false);
+	file_index_t res = file_index_build(directory, NULL, arena, &status);
+	if (!res)
+	{
+		arena_destroy(arena);
+		return NULL;
+	}
+	res->owns_arena = true;
+	return res;
+}
+
+void file_index_close(file_index_t index)
+{
+	if (!index)
+	{
+		return;
+	}
+	file_close(&index->file);
+	if (index->owns_arena)
+	{
+		arena_destroy(index->arena);
+	}
+}
+
+int file_index_count(file_index_t index)
+{
+	return index->count;
+}
+
+const char* file_index_name(file_index_t index, int section)
+{
+	return index->sections[section].name;
+}
+
+int file_index_find(file_index_t index, const char* name, int n)
+{
+	/* an index never holds an unknown section, it fails to build instead */
+	enum file_section_kind kind = file_section_kind(name, strlen(name));
+	if (kind == FILE_SECTION_UNKNOWN || n >= index->kind_counts[kind])
+	{
+		return -1;
+	}
+	for (int i = index->kind_first[kind]; i < index->count; i++)
+	{
+		if (index->sections[i].kind == kind && n-- == 0)
 		{
-			file_next(pfile, &curr);
-			MATCH_AND_ADVANCE_TOKEN(pfile, curr, TOKEN_NEWLINE);
-			debug_format("Palette ID %i requested\n", curr.data.integer);
-			MATCH_AND_ADVANCE_TOKEN(pfile, curr, TOKEN_INTEGER);
+			return i;
 		}
-		else if (strncmp(curr.data.str, "TileType", DATA_STRING_MAX_SIZE) == 0
-			|| strncmp(curr.data.str, "X weather", DATA_STRING_MAX_SIZE) == 0
-			|| strncmp(curr.data.str, "Transparency", DATA_STRING_MAX_SIZE) == 0)
+	}
+	return -1;
+}
+
+int file_index_width(file_index_t index)
+{
+	return index->width;
+}
+
+int file_index_height(file_index_t index)
+{
+	return index->height;
+}
+
+sprite_t file_load_sprite_view(const char* directory, const file_view_t* view, arena_t arena, file_status_t* status)
+{
+	/* the compiled cache is keyed on the file on disk, views have nothing to check it against */
+	uint64_t start = profile_begin();
+	*status = FILE_STATUS_OK;
+	sprite_t res = view ? NULL : cache_load_sprite(directory, arena);
+	if (res)
+	{
+		profile_end(PROFILE_LOAD, start);
+		return res;
+	}
+
+	/* everything but the sprite is scratch that's gone before this returns */
+	arena_t scratch = arena_scratch();
+	uint64_t index_start = profile_begin();
+	file_index_t index = file_index_build(directory, view, scratch, status);
+	profile_end(PROFILE_INDEX, index_start);
+	if (!index)
+	{
+		goto cleanup;
+	}
+
+	size_t cells = (size_t)index->width * index->height;
+	struct file_sprite_build build =
+	{
+		.data =
 		{
-			/* skip to next header */
-			while (file_next(pfile, &curr) && curr.type != TOKEN_HASHTAG);
-		}
-		else
+			.width = index->width,
+			.height = index->height,
+			.frame_count = index->kind_counts[FILE_SECTION_IMAGE],
+			.palette = -1,
+		},
+	};
+	/* every Image/Color pair after the first is another frame of an animation */
+	if (build.data.frame_count == 0 || index->kind_counts[FILE_SECTION_COLOR] != build.data.frame_count)
+	{
+		log_error("Sprite \"%s\" doesn't have one Color for every Image\n", directory);
+		goto cleanup;
+	}
+	build.row = arena_alloc(scratch, cells * sizeof * build.row);
+	build.text = arena_alloc(scratch, cells * build.data.frame_count * sizeof * build.text);
+	build.color = arena_alloc(scratch, cells * build.data.frame_count * sizeof * build.color);
+	build.planes = arena_alloc(scratch, cells * 2);
+
+	/* in file order, through each section's decoder. X weather and Z don't have one and are never read. */
+	for (int section = 0; section < index->count; section++)
+	{
+		enum file_section_kind kind = index->sections[section].kind;
+		const struct file_section_type* type = &file_section_types[kind];
+		if (type->decode && (type->is_per_frame || index->kind_first[kind] == section) && !type->decode(index, section, &build))
 		{
-			debug_format("Invalid sprite header \"%s\"\n", curr.data.str);
 			goto cleanup;
 		}
 	}
 
-	ENSURE_CONDITION(pfile, text);
-	ENSURE_CONDITION(pfile, color);
-
-	fclose(file.handle);
-	sprite_t res = screen_sprite_create(width, height, text, color);
-	free(text);
-	free(color);
-	return res;
+	build.data.text = build.text;
+	build.data.attrib = build.color;
+	res = screen_sprite_create_frames(&build.data, arena);
+	if (!view)
+	{
+		cache_store_sprite(directory, &index->file.view, res);
+	}
 cleanup:
-	free(text);
-	free(color);
-	fclose(file.handle);
-	return NULL;
+	if (!res && *status == FILE_STATUS_OK)
+	{
+		*status = FILE_STATUS_MALFORMED;
+	}
+	file_index_close(index);
+	arena_reset(scratch);
+	profile_end(PROFILE_LOAD, start);
+	return res;
+}
+
+sprite_t file_load_sprite(const char* directory)
+{
+	file_status_t status;
+	return file_load_sprite_view(directory, NULL, NULL, &status);
+}
+
+struct file_batch
+{
+	char** directories;
+	arena_t arena;
+	sprite_t* sprites;
+	file_status_t* statuses;
+};
+
+static void file_load_sprites_job(void* param, int index)
+{
+	struct file_batch* batch = param;
+	batch->sprites[index] = file_load_sprite_view(batch->directories[index], NULL, batch->arena, &batch->statuses[index]);
+}
+
+int file_load_sprites(char** directories, int count, arena_t arena, sprite_t* sprites, file_status_t* statuses)
+{
+	struct file_batch batch = { directories, arena, sprites, statuses };
+	thread_parallel_for(count, file_load_sprites_job, &batch);
+
+	int loaded = 0;
+	for (int i = 0; i < count; i++)
+	{
+		loaded += statuses[i] == FILE_STATUS_OK;
+	}
+	return loaded;
 }
\ No newline at end of file
@@ -4,6 +4,58 @@
 
 #pragma once
 
+#include "arena.h"
 #include "types.h"
 
-sprite_t file_load_sprite(const char* directory);
\ No newline at end of file
+/* Read-only view of a whole file, mapped into memory or copied to the heap */
+typedef struct file_view
+{
+	const char* data;
+	size_t size;
+	uint64_t mtime;
+	void* mapping; /* only used on Windows */
+	bool is_copy;
+} file_view_t;
+
+bool file_map(const char* path, file_view_t* out);
+/* Copies the file instead, for files that may be rewritten while they're parsed. A mapping would fault if they shrank. */
+bool file_read(const char* path, file_view_t* out);
+/* Releases a view from either of them */
+void file_unmap(file_view_t* view);
+bool file_stat(const char* path, uint64_t* mtime, uint64_t* size);
+
+typedef enum file_status
+{
+	FILE_STATUS_OK,
+	FILE_STATUS_MISSING,
+	FILE_STATUS_MALFORMED
+} file_status_t;
+
+/*
+	Where every "#Header" section of a sprite file is, found without decoding any of them.
+	Sections are decoded on demand, so tools can read e.g. Transparency without a full parse.
+*/
+typedef struct file_index* file_index_t;
+
+file_index_t file_index_open(const char* directory);
+void file_index_close(file_index_t index);
+int file_index_count(file_index_t index);
+const char* file_index_name(file_index_t index, int section);
+/* Returns the n-th section with the given name, or -1 */
+int file_index_find(file_index_t index, const char* name, int n);
+int file_index_width(file_index_t index);
+int file_index_height(file_index_t index);
+/* Decodes a Width by Height plane section into out, values above max are an error */
+bool file_index_read_plane(file_index_t index, int section, int max, attribute_t* out);
+
+sprite_t file_load_sprite(const char* directory);
+/*
+	Loads from view instead of mapping directory when view isn't NULL, directory then only names it in errors.
+	The sprite is allocated from arena, or the heap if it's NULL.
+*/
+sprite_t file_load_sprite_view(const char* directory, const file_view_t* view, arena_t arena, file_status_t* status);
+/*
+	Loads every directory in parallel. sprites[i] is NULL wherever statuses[i] isn't FILE_STATUS_OK. Returns the number loaded.
+	The sprites are allocated from arena, which has to be shared, or from the heap if it's NULL.
+*/
+int file_load_sprites(char** directories, int count, arena_t arena, sprite_t* sprites, file_status_t* statuses);
\ No newline at end of file
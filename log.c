@@ -0,0 +1,633 @@
+/*
+	log.c ~ RL
+*/
+
+#include "log.h"
+
+#include "thread.h"
+#include "types.h"
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+/* Bytes in each thread's ring, a power of two */
+#define LOG_RING_SIZE (64 * 1024)
+/* Most a single call can take up in a ring, longer strings are cut short to fit */
+#define LOG_RECORD_MAX 4096
+#define LOG_STRING_MAX 1024
+/* Longest a message gets once it's formatted */
+#define LOG_MESSAGE_MAX 4096
+/* How often the drain thread writes out what's been logged */
+#define LOG_DRAIN_INTERVAL_MS 10
+/* Most text kept back while the default output is held, later messages are counted as dropped */
+#define LOG_HELD_MAX (1024 * 1024)
+#define LOG_SLOT_SIZE 8
+#define LOG_ALIGN(x) (((x) + LOG_SLOT_SIZE - 1) & ~(size_t)(LOG_SLOT_SIZE - 1))
+
+typedef enum log_argument
+{
+	LOG_ARGUMENT_NONE,
+	LOG_ARGUMENT_INT,
+	LOG_ARGUMENT_LONG,
+	LOG_ARGUMENT_LONG_LONG,
+	LOG_ARGUMENT_SIZE,
+	LOG_ARGUMENT_INTMAX,
+	LOG_ARGUMENT_PTRDIFF,
+	LOG_ARGUMENT_DOUBLE,
+	LOG_ARGUMENT_STRING,
+	LOG_ARGUMENT_POINTER
+} log_argument_t;
+
+/* A single % conversion in a format, the same parse is used to capture arguments and to format them */
+struct log_conversion
+{
+	const char* begin;
+	const char* end;
+	/* each '*' width or precision takes an int before the value */
+	int star_count;
+	log_argument_t argument;
+};
+
+/*
+	A message in a ring is this header, then every argument in order in LOG_SLOT_SIZE slots. Strings are a
+	uint32_t length, counting the terminator, followed by their chars and padded to a slot.
+	A header without a format pads out the end of the ring, as does any gap too small to hold a header.
+*/
+struct log_record
+{
+	uint32_t size;
+	int32_t level;
+	const char* fmt;
+	uint64_t time;
+};
+
+/* Written only by the thread that owns it, and read only with the drain lock held */
+struct log_ring
+{
+	volatile int32_t head;
+	volatile int32_t tail;
+	volatile int32_t dropped;
+	struct log_ring* next;
+	uint8_t data[LOG_RING_SIZE];
+};
+
+static struct log_state
+{
+	volatile int32_t start_claim;
+	volatile int32_t is_started;
+	/* held for a whole drain, and while the ring list or output change */
+	mutex_t lock;
+	/* rings outlive their threads, so nothing logged is lost when one exits */
+	struct log_ring* rings;
+	/* NULL for the default output */
+	FILE* output;
+	/* messages for the default output wait in held until log_hold releases them */
+	bool is_held;
+	char* held;
+	size_t held_length;
+	int held_dropped;
+	bool is_stopped;
+	thread_t thread;
+} log_state;
+
+static THREAD_LOCAL struct log_ring* log_ring;
+
+static const char* log_parse_conversion(const char* p, struct log_conversion* out)
+{
+	out->begin = p++;
+	out->star_count = 0;
+	while (*p && strchr("-+ #0", *p))
+	{
+		p++;
+	}
+	for (int part = 0; part < 2; part++)
+	{
+		if (part == 1 && *p != '.')
+		{
+			break;
+		}
+		p += part;
+		if (*p == '*')
+		{
+			out->star_count++;
+			p++;
+		}
+		while (*p >= '0' && *p <= '9')
+		{
+			p++;
+		}
+	}
+	int long_count = 0;
+	char modifier = 0;
+	while (*p && strchr("hlLzjt", *p))
+	{
+		long_count += *p == 'l';
+		modifier = *p++;
+	}
+	switch (*p)
+	{
+	case 'd':
+	case 'i':
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X':
+	case 'c':
+		out->argument = long_count >= 2 ? LOG_ARGUMENT_LONG_LONG
+			: long_count ? LOG_ARGUMENT_LONG
+			: modifier == 'z' ? LOG_ARGUMENT_SIZE
+			: modifier == 'j' ? LOG_ARGUMENT_INTMAX
+			: modifier == 't' ? LOG_ARGUMENT_PTRDIFF
+			: LOG_ARGUMENT_INT;
+		break;
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		out->argument = modifier == 'L' ? LOG_ARGUMENT_NONE : LOG_ARGUMENT_DOUBLE;
+		break;
+	case 's':
+		out->argument = LOG_ARGUMENT_STRING;
+		break;
+	case 'p':
+		out->argument = LOG_ARGUMENT_POINTER;
+		break;
+	default:
+		/* %% and anything unsupported, which is written as is */
+		out->argument = LOG_ARGUMENT_NONE;
+		break;
+	}
+	out->end = *p ? p + 1 : p;
+	return out->end;
+}
+
+/* Keeps a message back while the default output is held */
+static void log_keep(const char* message)
+{
+	size_t length = strlen(message);
+	if (log_state.held_length + length > LOG_HELD_MAX)
+	{
+		log_state.held_dropped++;
+		return;
+	}
+	if (!log_state.held)
+	{
+		log_state.held = dig_malloc(LOG_HELD_MAX + 1);
+	}
+	memcpy(log_state.held + log_state.held_length, message, length + 1);
+	log_state.held_length += length;
+}
+
+static void log_emit(const char* message)
+{
+	if (log_state.output)
+	{
+		fputs(message, log_state.output);
+		return;
+	}
+	if (log_state.is_held)
+	{
+		log_keep(message);
+		return;
+	}
+#ifdef _WIN32
+	OutputDebugStringA(message);
+#else
+	fputs(message, stderr);
+#endif
+}
+
+/* Skips padding, returns false if the ring is empty */
+static bool log_peek(struct log_ring* ring, const struct log_record** out)
+{
+	for (;;)
+	{
+		uint32_t tail = (uint32_t)ring->tail, head = (uint32_t)atomic_load32(&ring->head);
+		if (tail == head)
+		{
+			return false;
+		}
+		uint32_t offset = tail & (LOG_RING_SIZE - 1);
+		const struct log_record* record = (const struct log_record*)(ring->data + offset);
+		if (LOG_RING_SIZE - offset < sizeof * record || !record->fmt)
+		{
+			atomic_store32(&ring->tail, (int32_t)(tail + (LOG_RING_SIZE - offset < sizeof * record ? LOG_RING_SIZE - offset : record->size)));
+			continue;
+		}
+		*out = record;
+		return true;
+	}
+}
+
+static void log_format(const struct log_record* record, char* out, size_t capacity)
+{
+	const uint8_t* argument = (const uint8_t*)(record + 1);
+	size_t length = 0;
+	for (const char* p = record->fmt; *p && length < capacity - 1;)
+	{
+		if (*p != '%')
+		{
+			out[length++] = *p++;
+			continue;
+		}
+		struct log_conversion conversion;
+		p = log_parse_conversion(p, &conversion);
+
+		/* stars are replaced by the values passed for them, so snprintf only ever takes the one argument */
+		char spec[64];
+		size_t spec_length = 0;
+		for (const char* c = conversion.begin; c < conversion.end && spec_length < sizeof spec - 16; c++)
+		{
+			if (*c != '*' || conversion.argument == LOG_ARGUMENT_NONE)
+			{
+				spec[spec_length++] = *c;
+				continue;
+			}
+			int64_t star;
+			memcpy(&star, argument, sizeof star);
+			argument += LOG_SLOT_SIZE;
+			spec_length += snprintf(spec + spec_length, sizeof spec - spec_length, "%i", (int)star);
+		}
+		spec[spec_length] = '\0';
+
+		int64_t value = 0;
+		if (conversion.argument != LOG_ARGUMENT_NONE && conversion.argument != LOG_ARGUMENT_STRING)
+		{
+			memcpy(&value, argument, sizeof value);
+			argument += LOG_SLOT_SIZE;
+		}
+		double decimal;
+		memcpy(&decimal, &value, sizeof decimal);
+		uint32_t string_length;
+		char* dst = out + length;
+		size_t remaining = capacity - length;
+		int written = 0;
+		switch (conversion.argument)
+		{
+		case LOG_ARGUMENT_NONE:
+			written = conversion.end - conversion.begin == 2 && conversion.begin[1] == '%'
+				? snprintf(dst, remaining, "%%")
+				: snprintf(dst, remaining, "%.*s", (int)(conversion.end - conversion.begin), conversion.begin);
+			break;
+		case LOG_ARGUMENT_INT:
+			written = snprintf(dst, remaining, spec, (int)value);
+			break;
+		case LOG_ARGUMENT_LONG:
+			written = snprintf(dst, remaining, spec, (long)value);
+			break;
+		case LOG_ARGUMENT_LONG_LONG:
+			written = snprintf(dst, remaining, spec, (long long)value);
+			break;
+		case LOG_ARGUMENT_SIZE:
+			written = snprintf(dst, remaining, spec, (size_t)value);
+			break;
+		case LOG_ARGUMENT_INTMAX:
+			written = snprintf(dst, remaining, spec, (intmax_t)value);
+			break;
+		case LOG_ARGUMENT_PTRDIFF:
+			written = snprintf(dst, remaining, spec, (ptrdiff_t)value);
+			break;
+		case LOG_ARGUMENT_DOUBLE:
+			written = snprintf(dst, remaining, spec, decimal);
+			break;
+		case LOG_ARGUMENT_POINTER:
+			written = snprintf(dst, remaining, spec, (void*)(uintptr_t)value);
+			break;
+		case LOG_ARGUMENT_STRING:
+			memcpy(&string_length, argument, sizeof string_length);
+			written = snprintf(dst, remaining, spec, (const char*)argument + sizeof string_length);
+			argument += LOG_ALIGN(sizeof string_length + string_length);
+			break;
+		}
+		length += written < 0 ? 0 : (size_t)written < remaining ? (size_t)written : remaining - 1;
+	}
+	out[length] = '\0';
+}
+
+/* Writes every ring out oldest message first, with the lock held */
+static void log_drain(void)
+{
+	static char message[LOG_MESSAGE_MAX];
+	for (struct log_ring* ring = log_state.rings; ring; ring = ring->next)
+	{
+		int32_t dropped = atomic_load32(&ring->dropped);
+		if (dropped)
+		{
+			atomic_add32(&ring->dropped, -dropped);
+			snprintf(message, sizeof message, "%i log messages were dropped\n", dropped);
+			log_emit(message);
+		}
+	}
+	for (;;)
+	{
+		struct log_ring* oldest = NULL;
+		const struct log_record* record = NULL;
+		for (struct log_ring* ring = log_state.rings; ring; ring = ring->next)
+		{
+			const struct log_record* next;
+			if (log_peek(ring, &next) && (!record || next->time < record->time))
+			{
+				oldest = ring;
+				record = next;
+			}
+		}
+		if (!record)
+		{
+			break;
+		}
+		log_format(record, message, sizeof message);
+		log_emit(message);
+		atomic_store32(&oldest->tail, (int32_t)((uint32_t)oldest->tail + record->size));
+	}
+	fflush(log_state.output ? log_state.output : stderr);
+}
+
+void log_flush(void)
+{
+	if (!atomic_load32(&log_state.is_started))
+	{
+		return;
+	}
+	mutex_lock(log_state.lock);
+	if (!log_state.is_stopped)
+	{
+		log_drain();
+	}
+	mutex_unlock(log_state.lock);
+}
+
+/* Writes out what was held back, with the lock held */
+static void log_release(void)
+{
+	log_state.is_held = false;
+	if (log_state.held_length)
+	{
+		log_emit(log_state.held);
+	}
+	if (log_state.held_dropped)
+	{
+		char message[64];
+		snprintf(message, sizeof message, "%i log messages were dropped while held\n", log_state.held_dropped);
+		log_emit(message);
+	}
+	free(log_state.held);
+	log_state.held = NULL;
+	log_state.held_length = 0;
+	log_state.held_dropped = 0;
+	fflush(log_state.output ? log_state.output : stderr);
+}
+
+/* Last drain when the program exits, the drain thread is left alone after that */
+static void log_stop(void)
+{
+	mutex_lock(log_state.lock);
+	log_drain();
+	/* held messages aren't lost when the program exits without releasing them */
+	log_release();
+	log_state.is_stopped = true;
+	if (log_state.output)
+	{
+		fclose(log_state.output);
+		log_state.output = NULL;
+	}
+	mutex_unlock(log_state.lock);
+}
+
+static void log_drain_thread(void* param)
+{
+	(void)param;
+	for (;;)
+	{
+		thread_sleep(LOG_DRAIN_INTERVAL_MS);
+		log_flush();
+	}
+}
+
+/* Started by the first message, so logging works before main has done anything */
+static void log_start(void)
+{
+	if (atomic_add32(&log_state.start_claim, 1) != 1)
+	{
+		while (!atomic_load32(&log_state.is_started))
+		{
+			thread_sleep(0);
+		}
+		return;
+	}
+	log_state.lock = mutex_create();
+	atexit(log_stop);
+	atomic_store32(&log_state.is_started, 1);
+	/* after it's marked started, so a failure here can be logged */
+	log_state.thread = thread_create(log_drain_thread, NULL);
+}
+
+static struct log_ring* log_register(void)
+{
+	if (!atomic_load32(&log_state.is_started))
+	{
+		log_start();
+	}
+	struct log_ring* ring = dig_malloc(sizeof * ring);
+	ring->head = ring->tail = ring->dropped = 0;
+	mutex_lock(log_state.lock);
+	ring->next = log_state.rings;
+	log_state.rings = ring;
+	mutex_unlock(log_state.lock);
+	log_ring = ring;
+	return ring;
+}
+
+static bool log_put(uint8_t** cursor, const uint8_t* end, const void* value, size_t size)
+{
+	if (*cursor + LOG_ALIGN(size) > end)
+	{
+		return false;
+	}
+	memcpy(*cursor, value, size);
+	*cursor += LOG_ALIGN(size);
+	return true;
+}
+
+static bool log_put_integer(uint8_t** cursor, const uint8_t* end, int64_t value)
+{
+	return log_put(cursor, end, &value, sizeof value);
+}
+
+static bool log_put_string(uint8_t** cursor, const uint8_t* end, const char* string)
+{
+	string = string ? string : "(null)";
+	uint32_t size;
+	if (*cursor + sizeof size + 1 > end)
+	{
+		return false;
+	}
+	size_t room = end - *cursor - sizeof size - 1;
+	size_t length = strlen(string);
+	length = length < LOG_STRING_MAX ? length : LOG_STRING_MAX;
+	length = length < room ? length : room;
+	size = (uint32_t)length + 1;
+	memcpy(*cursor, &size, sizeof size);
+	memcpy(*cursor + sizeof size, string, length);
+	(*cursor)[sizeof size + length] = '\0';
+	*cursor += LOG_ALIGN(sizeof size + size);
+	return true;
+}
+
+/* Copies a finished record into the ring, wrapping to the start rather than splitting it */
+static void log_push(struct log_ring* ring, const void* record, uint32_t size)
+{
+	uint32_t head = (uint32_t)ring->head, tail = (uint32_t)atomic_load32(&ring->tail);
+	uint32_t offset = head & (LOG_RING_SIZE - 1);
+	uint32_t padding = offset + size > LOG_RING_SIZE ? LOG_RING_SIZE - offset : 0;
+	if (LOG_RING_SIZE - (head - tail) < padding + size)
+	{
+		atomic_add32(&ring->dropped, 1);
+		return;
+	}
+	if (padding >= sizeof(struct log_record))
+	{
+		struct log_record pad = { padding, 0, NULL, 0 };
+		memcpy(ring->data + offset, &pad, sizeof pad);
+	}
+	memcpy(ring->data + ((head + padding) & (LOG_RING_SIZE - 1)), record, size);
+	atomic_store32(&ring->head, (int32_t)(head + padding + size));
+}
+
+void log_write(int level, const char* fmt, ...)
+{
+	struct log_ring* ring = log_ring ? log_ring : log_register();
+	union
+	{
+		struct log_record header;
+		uint64_t align;
+		uint8_t bytes[LOG_RECORD_MAX];
+	} record;
+	uint8_t* cursor = record.bytes + sizeof record.header;
+	const uint8_t* end = record.bytes + sizeof record.bytes;
+	bool fits = true;
+
+	/* only the arguments are copied, the drain thread formats them */
+	va_list list;
+	va_start(list, fmt);
+	for (const char* p = fmt; *p && fits;)
+	{
+		if (*p != '%')
+		{
+			p++;
+			continue;
+		}
+		struct log_conversion conversion;
+		p = log_parse_conversion(p, &conversion);
+		if (conversion.argument == LOG_ARGUMENT_NONE)
+		{
+			continue;
+		}
+		for (int i = 0; i < conversion.star_count && fits; i++)
+		{
+			fits = log_put_integer(&cursor, end, va_arg(list, int));
+		}
+		double decimal;
+		void* pointer;
+		switch (conversion.argument)
+		{
+		case LOG_ARGUMENT_NONE:
+			break;
+		case LOG_ARGUMENT_INT:
+			fits = fits && log_put_integer(&cursor, end, va_arg(list, int));
+			break;
+		case LOG_ARGUMENT_LONG:
+			fits = fits && log_put_integer(&cursor, end, va_arg(list, long));
+			break;
+		case LOG_ARGUMENT_LONG_LONG:
+			fits = fits && log_put_integer(&cursor, end, va_arg(list, long long));
+			break;
+		case LOG_ARGUMENT_SIZE:
+			fits = fits && log_put_integer(&cursor, end, (int64_t)va_arg(list, size_t));
+			break;
+		case LOG_ARGUMENT_INTMAX:
+			fits = fits && log_put_integer(&cursor, end, va_arg(list, intmax_t));
+			break;
+		case LOG_ARGUMENT_PTRDIFF:
+			fits = fits && log_put_integer(&cursor, end, va_arg(list, ptrdiff_t));
+			break;
+		case LOG_ARGUMENT_DOUBLE:
+			decimal = va_arg(list, double);
+			fits = fits && log_put(&cursor, end, &decimal, sizeof decimal);
+			break;
+		case LOG_ARGUMENT_POINTER:
+			pointer = va_arg(list, void*);
+			fits = fits && log_put_integer(&cursor, end, (int64_t)(uintptr_t)pointer);
+			break;
+		case LOG_ARGUMENT_STRING:
+			fits = fits && log_put_string(&cursor, end, va_arg(list, const char*));
+			break;
+		}
+	}
+	va_end(list);
+
+	if (!fits)
+	{
+		atomic_add32(&ring->dropped, 1);
+		return;
+	}
+	record.header.size = (uint32_t)(cursor - record.bytes);
+	record.header.level = level;
+	record.header.fmt = fmt;
+	record.header.time = debug_time_ns();
+	log_push(ring, record.bytes, record.header.size);
+}
+
+void log_hold(bool is_held)
+{
+	if (!atomic_load32(&log_state.is_started))
+	{
+		log_start();
+	}
+	mutex_lock(log_state.lock);
+	if (!log_state.is_stopped)
+	{
+		/* what's already logged goes out before the hold changes */
+		log_drain();
+		if (is_held)
+		{
+			log_state.is_held = true;
+		}
+		else
+		{
+			log_release();
+		}
+	}
+	mutex_unlock(log_state.lock);
+}
+
+bool log_open(const char* path)
+{
+	FILE* output = fopen(path, "a");
+	if (!output)
+	{
+		log_error("Failed to open log file \"%s\"\n", path);
+		return false;
+	}
+	if (!atomic_load32(&log_state.is_started))
+	{
+		log_start();
+	}
+	/* what's already logged goes where it was meant to */
+	mutex_lock(log_state.lock);
+	log_drain();
+	if (log_state.output)
+	{
+		fclose(log_state.output);
+	}
+	log_state.output = output;
+	mutex_unlock(log_state.lock);
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+/*
+	log.h ~ RL
+
+	Asynchronous logging. A call copies its arguments into a ring owned by the calling thread, without locking
+	or formatting, and a background thread formats and writes everything out. Messages are dropped rather
+	than waited for when a ring is full.
+
+	The format has to be a string literal, or otherwise live until the program exits, since it's only read
+	when the message is written. %s arguments are copied, so they only need to last the call. Conversions
+	are printf's, except for %n and long double.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+/* Calls above this level are compiled out, arguments and all */
+#ifndef LOG_LEVEL
+#ifdef _DEBUG
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#else
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define log_error(...) log_write(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define log_error(...) ((void)0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARNING
+#define log_warning(...) log_write(LOG_LEVEL_WARNING, __VA_ARGS__)
+#else
+#define log_warning(...) ((void)0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define log_info(...) log_write(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define log_info(...) ((void)0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define log_debug(...) log_write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define log_debug(...) ((void)0)
+#endif
+
+/* Use the macros above, so disabled levels cost nothing */
+void log_write(int level, const char* fmt, ...);
+/*
+	Sends messages to the file at path instead of the default, stderr (and the debugger on Windows).
+	Everything logged before the call goes to the default.
+*/
+bool log_open(const char* path);
+/*
+	While held, messages for the default output are kept back and written once it's released, so they don't
+	draw over a screen on the terminal stderr goes to. A file from log_open is written to as usual.
+*/
+void log_hold(bool is_held);
+/* Writes out everything logged so far on the calling thread. Runs by itself when the program exits. */
+void log_flush(void);
\ No newline at end of file
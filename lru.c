@@ -0,0 +1,273 @@
+/*
+	lru.c ~ RL
+*/
+
+#include "lru.h"
+
+#include "debug.h"
+#include "screen.h"
+#include "store.h"
+#include "thread.h"
+#include <string.h>
+
+#define LRU_BUCKET_COUNT 1024
+#define LRU_PLANE_BUCKET_COUNT 1024
+
+struct lru_entry
+{
+	int key;
+	int refs;
+	sprite_t sprite;
+	size_t size;
+	struct lru_entry* prev;
+	struct lru_entry* next;
+	struct lru_entry* bucket_next;
+};
+
+/* A plane from the store that cached sprites share, charged once for as long as any of them is cached */
+struct lru_plane
+{
+	const void* plane;
+	size_t size;
+	int holders;
+	struct lru_plane* next;
+};
+
+struct lru
+{
+	mutex_t lock;
+	size_t capacity;
+	size_t used;
+	/* sentinel, head.next is the most recently used */
+	struct lru_entry head;
+	struct lru_entry* buckets[LRU_BUCKET_COUNT];
+	struct lru_plane* planes[LRU_PLANE_BUCKET_COUNT];
+};
+
+static inline struct lru_entry** lru_bucket(lru_t lru, int key)
+{
+	return &lru->buckets[(unsigned)key * 2654435761u % LRU_BUCKET_COUNT];
+}
+
+static struct lru_entry* lru_find(lru_t lru, int key)
+{
+	struct lru_entry* entry = *lru_bucket(lru, key);
+	while (entry && entry->key != key)
+	{
+		entry = entry->bucket_next;
+	}
+	return entry;
+}
+
+static void lru_unlink(struct lru_entry* entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+}
+
+static void lru_push_front(lru_t lru, struct lru_entry* entry)
+{
+	entry->prev = &lru->head;
+	entry->next = lru->head.next;
+	lru->head.next->prev = entry;
+	lru->head.next = entry;
+}
+
+static inline struct lru_plane** lru_plane_bucket(lru_t lru, const void* plane)
+{
+	/* planes are malloc aligned, so the low bits say nothing */
+	return &lru->planes[(uintptr_t)plane >> 4 & (LRU_PLANE_BUCKET_COUNT - 1)];
+}
+
+/* Charges the sprite's stored planes, the ones no other cached sprite holds yet */
+static void lru_hold_planes(lru_t lru, sprite_t sprite)
+{
+	const void* planes[SCREEN_STORED_PLANES_MAX];
+	int count = screen_sprite_stored_planes(sprite, planes);
+	for (int i = 0; i < count; i++)
+	{
+		struct lru_plane** bucket = lru_plane_bucket(lru, planes[i]);
+		struct lru_plane* held = *bucket;
+		while (held && held->plane != planes[i])
+		{
+			held = held->next;
+		}
+		if (!held)
+		{
+			held = dig_malloc(sizeof * held);
+			held->plane = planes[i];
+			held->size = store_size(planes[i]);
+			held->holders = 0;
+			held->next = *bucket;
+			*bucket = held;
+			lru->used += held->size;
+		}
+		held->holders++;
+	}
+}
+
+/* Undoes lru_hold_planes, a plane stops being charged once the last cached sprite holding it goes */
+static void lru_drop_planes(lru_t lru, sprite_t sprite)
+{
+	const void* planes[SCREEN_STORED_PLANES_MAX];
+	int count = screen_sprite_stored_planes(sprite, planes);
+	for (int i = 0; i < count; i++)
+	{
+		struct lru_plane** link = lru_plane_bucket(lru, planes[i]);
+		while ((*link)->plane != planes[i])
+		{
+			link = &(*link)->next;
+		}
+		struct lru_plane* held = *link;
+		if (--held->holders == 0)
+		{
+			*link = held->next;
+			lru->used -= held->size;
+			free(held);
+		}
+	}
+}
+
+static void lru_remove(lru_t lru, struct lru_entry* entry)
+{
+	struct lru_entry** link = lru_bucket(lru, entry->key);
+	while (*link != entry)
+	{
+		link = &(*link)->bucket_next;
+	}
+	*link = entry->bucket_next;
+	lru_unlink(entry);
+	lru->used -= entry->size;
+	lru_drop_planes(lru, entry->sprite);
+	screen_sprite_destroy(entry->sprite);
+	free(entry);
+}
+
+/* Evicts unpinned entries from the cold end until extra more bytes fit */
+static void lru_make_room(lru_t lru, size_t extra)
+{
+	struct lru_entry* entry = lru->head.prev;
+	while (lru->used + extra > lru->capacity && entry != &lru->head)
+	{
+		struct lru_entry* prev = entry->prev;
+		if (entry->refs == 0)
+		{
+			lru_remove(lru, entry);
+		}
+		entry = prev;
+	}
+}
+
+lru_t lru_create(size_t capacity)
+{
+	lru_t res = dig_malloc(sizeof * res);
+	memset(res, 0, sizeof * res);
+	res->lock = mutex_create();
+	res->capacity = capacity;
+	res->head.prev = res->head.next = &res->head;
+	return res;
+}
+
+void lru_destroy(lru_t lru)
+{
+	if (!lru)
+	{
+		return;
+	}
+	while (lru->head.next != &lru->head)
+	{
+		lru_remove(lru, lru->head.next);
+	}
+	mutex_destroy(lru->lock);
+	free(lru);
+}
+
+sprite_t lru_acquire(lru_t lru, int key)
+{
+	mutex_lock(lru->lock);
+	struct lru_entry* entry = lru_find(lru, key);
+	sprite_t res = NULL;
+	if (entry)
+	{
+		lru_unlink(entry);
+		lru_push_front(lru, entry);
+		entry->refs++;
+		res = entry->sprite;
+	}
+	mutex_unlock(lru->lock);
+	return res;
+}
+
+void lru_release(lru_t lru, int key)
+{
+	mutex_lock(lru->lock);
+	struct lru_entry* entry = lru_find(lru, key);
+	if (entry && entry->refs > 0)
+	{
+		entry->refs--;
+	}
+	mutex_unlock(lru->lock);
+}
+
+bool lru_contains(lru_t lru, int key)
+{
+	mutex_lock(lru->lock);
+	bool res = lru_find(lru, key) != NULL;
+	mutex_unlock(lru->lock);
+	return res;
+}
+
+static sprite_t lru_insert_locked(lru_t lru, int key, sprite_t sprite, bool acquire)
+{
+	struct lru_entry* entry = lru_find(lru, key);
+	if (entry)
+	{
+		/* someone else loaded it first */
+		screen_sprite_destroy(sprite);
+		lru_unlink(entry);
+	}
+	else
+	{
+		entry = dig_malloc(sizeof * entry);
+		entry->key = key;
+		entry->refs = 0;
+		entry->sprite = sprite;
+		entry->size = screen_sprite_size(sprite);
+		/* held before making room, so evicting a sprite that shares them can't let them go */
+		lru_hold_planes(lru, sprite);
+		lru_make_room(lru, entry->size);
+
+		struct lru_entry** bucket = lru_bucket(lru, key);
+		entry->bucket_next = *bucket;
+		*bucket = entry;
+		lru->used += entry->size;
+	}
+	lru_push_front(lru, entry);
+	entry->refs += acquire;
+	return entry->sprite;
+}
+
+sprite_t lru_insert(lru_t lru, int key, sprite_t sprite, bool acquire)
+{
+	mutex_lock(lru->lock);
+	sprite_t res = lru_insert_locked(lru, key, sprite, acquire);
+	mutex_unlock(lru->lock);
+	return res;
+}
+
+sprite_t lru_replace(lru_t lru, int key, sprite_t sprite, bool acquire)
+{
+	mutex_lock(lru->lock);
+	struct lru_entry* entry = lru_find(lru, key);
+	sprite_t res = NULL;
+	if (!entry || entry->refs == 0)
+	{
+		if (entry)
+		{
+			lru_remove(lru, entry);
+		}
+		res = lru_insert_locked(lru, key, sprite, acquire);
+	}
+	mutex_unlock(lru->lock);
+	return res;
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+/*
+	lru.h ~ RL
+
+	Bounded, thread-safe least-recently-used set of loaded sprites. Capacity is in bytes, with a plane that
+	cached sprites share through the plane store counted once for as long as any of them is cached.
+*/
+
+#pragma once
+
+#include "types.h"
+
+typedef struct lru* lru_t;
+
+lru_t lru_create(size_t capacity);
+void lru_destroy(lru_t lru);
+
+/* Returns NULL on a miss. A hit is pinned until lru_release so it's never evicted while in use. */
+sprite_t lru_acquire(lru_t lru, int key);
+void lru_release(lru_t lru, int key);
+bool lru_contains(lru_t lru, int key);
+/* Takes ownership of sprite. If key is already present the new sprite is destroyed and the resident one is used. */
+sprite_t lru_insert(lru_t lru, int key, sprite_t sprite, bool acquire);
+/* Swaps sprite in for whatever key held, destroying the old one. Returns NULL without taking ownership if the old one is pinned. */
+sprite_t lru_replace(lru_t lru, int key, sprite_t sprite, bool acquire);
\ No newline at end of file
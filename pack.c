@@ -0,0 +1,292 @@
+/*
+	pack.c ~ RL
+*/
+
+#include "pack.h"
+
+#include "log.h"
+#include "thread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PACK_MAGIC 0x504E5244 /* "DNRP" */
+#define PACK_VERSION 1
+#define PACK_ALIGNMENT 8
+#define PACK_ALIGN(x) (((x) + PACK_ALIGNMENT - 1) & ~(uint64_t)(PACK_ALIGNMENT - 1))
+
+/*
+	Layout of a pack:
+		header
+		entries (entry_count pack_entry, sorted by name)
+		names (null terminated, so they can be handed out in place)
+		contents of every entry, each aligned to PACK_ALIGNMENT
+*/
+struct pack_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_count;
+	uint32_t names_size;
+};
+
+struct pack_entry
+{
+	uint64_t offset;
+	uint64_t size;
+	uint64_t hash;
+	uint32_t name_offset;
+	uint32_t name_length;
+};
+
+struct pack
+{
+	file_view_t view;
+	const struct pack_entry* entries;
+	const char* names;
+	int count;
+};
+
+struct pack_batch
+{
+	pack_t pack;
+	int first;
+	arena_t arena;
+	sprite_t* sprites;
+	file_status_t* statuses;
+};
+
+/* A file to write, sorted by name with its position in the caller's arrays carried along */
+struct pack_order
+{
+	const char* name;
+	int index;
+};
+
+static int pack_compare_order(const void* a, const void* b)
+{
+	return strcmp(((const struct pack_order*)a)->name, ((const struct pack_order*)b)->name);
+}
+
+static bool pack_write_padding(FILE* handle, uint64_t written)
+{
+	static const char zeroes[PACK_ALIGNMENT];
+	size_t padding = (size_t)(PACK_ALIGN(written) - written);
+	return fwrite(zeroes, 1, padding, handle) == padding;
+}
+
+bool pack_build(const char* output, char** paths, char** names, int count)
+{
+	/* every file is mapped up front, the index needs their sizes and hashes before any contents are written */
+	struct pack_order* order = dig_malloc(count * sizeof * order);
+	file_view_t* views = dig_malloc(count * sizeof * views);
+	struct pack_entry* entries = dig_malloc(count * sizeof * entries);
+	int mapped = 0;
+	bool ok = true;
+	for (; mapped < count; mapped++)
+	{
+		order[mapped] = (struct pack_order) { names[mapped], mapped };
+		if (!file_map(paths[mapped], &views[mapped]))
+		{
+			log_error("Failed to read \"%s\" into the pack\n", paths[mapped]);
+			ok = false;
+			goto cleanup;
+		}
+	}
+	qsort(order, count, sizeof * order, pack_compare_order);
+
+	struct pack_header header = { PACK_MAGIC, PACK_VERSION, (uint32_t)count, 0 };
+	for (int i = 0; i < count; i++)
+	{
+		entries[i].name_offset = header.names_size;
+		entries[i].name_length = (uint32_t)strlen(order[i].name);
+		header.names_size += entries[i].name_length + 1;
+	}
+	uint64_t offset = PACK_ALIGN(sizeof header + count * sizeof * entries + header.names_size);
+	for (int i = 0; i < count; i++)
+	{
+		const file_view_t* view = &views[order[i].index];
+		entries[i].offset = offset;
+		entries[i].size = view->size;
+		entries[i].hash = dig_hash(view->data, view->size);
+		offset = PACK_ALIGN(offset + view->size);
+	}
+
+	FILE* handle = fopen(output, "wb");
+	if (!handle)
+	{
+		log_error("Failed to create pack \"%s\"\n", output);
+		ok = false;
+		goto cleanup;
+	}
+	ok = fwrite(&header, sizeof header, 1, handle) == 1
+		&& fwrite(entries, sizeof * entries, count, handle) == (size_t)count;
+	for (int i = 0; i < count && ok; i++)
+	{
+		ok = fwrite(order[i].name, 1, entries[i].name_length + 1, handle) == entries[i].name_length + 1;
+	}
+	ok = ok && pack_write_padding(handle, sizeof header + count * sizeof * entries + header.names_size);
+	for (int i = 0; i < count && ok; i++)
+	{
+		const file_view_t* view = &views[order[i].index];
+		ok = fwrite(view->data, 1, view->size, handle) == view->size
+			&& pack_write_padding(handle, entries[i].offset + view->size);
+	}
+	ok = fclose(handle) == 0 && ok;
+	if (!ok)
+	{
+		log_error("Failed to write pack \"%s\"\n", output);
+		remove(output);
+	}
+cleanup:
+	for (int i = 0; i < mapped; i++)
+	{
+		file_unmap(&views[i]);
+	}
+	free(order);
+	free(views);
+	free(entries);
+	return ok;
+}
+
+pack_t pack_open(const char* path)
+{
+	pack_t res = dig_malloc(sizeof * res);
+	if (!file_map(path, &res->view))
+	{
+		log_error("Failed to open pack \"%s\"\n", path);
+		free(res);
+		return NULL;
+	}
+
+	/* the index is checked once here so the accessors can trust it */
+	const struct pack_header* header = (const struct pack_header*)res->view.data;
+	if (res->view.size < sizeof * header
+		|| header->magic != PACK_MAGIC
+		|| header->version != PACK_VERSION)
+	{
+		goto cleanup;
+	}
+	size_t index_size = sizeof * header + (size_t)header->entry_count * sizeof * res->entries;
+	if (index_size + header->names_size > res->view.size)
+	{
+		goto cleanup;
+	}
+	res->entries = (const struct pack_entry*)(header + 1);
+	res->names = res->view.data + index_size;
+	res->count = (int)header->entry_count;
+	for (int i = 0; i < res->count; i++)
+	{
+		const struct pack_entry* entry = &res->entries[i];
+		if (entry->name_offset + (uint64_t)entry->name_length >= header->names_size
+			|| res->names[entry->name_offset + entry->name_length] != '\0'
+			|| entry->offset > res->view.size || entry->size > res->view.size - entry->offset)
+		{
+			goto cleanup;
+		}
+		/* lookups binary search the names, so a pack that isn't strictly sorted would just miss */
+		if (i > 0 && strcmp(pack_name(res, i - 1), pack_name(res, i)) >= 0)
+		{
+			goto cleanup;
+		}
+	}
+	return res;
+cleanup:
+	log_error("Pack \"%s\" is malformed\n", path);
+	pack_close(res);
+	return NULL;
+}
+
+void pack_close(pack_t pack)
+{
+	if (!pack)
+	{
+		return;
+	}
+	file_unmap(&pack->view);
+	free(pack);
+}
+
+int pack_count(pack_t pack)
+{
+	return pack->count;
+}
+
+/* First entry whose name isn't ordered before name, up to n characters */
+static int pack_lower_bound(pack_t pack, const char* name, size_t n)
+{
+	int low = 0, high = pack->count;
+	while (low < high)
+	{
+		int mid = low + (high - low) / 2;
+		if (strncmp(pack_name(pack, mid), name, n) < 0)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+	return low;
+}
+
+int pack_find(pack_t pack, const char* name)
+{
+	int res = pack_lower_bound(pack, name, strlen(name) + 1);
+	return res < pack->count && strcmp(pack_name(pack, res), name) == 0 ? res : -1;
+}
+
+int pack_range(pack_t pack, const char* prefix, int* first)
+{
+	size_t length = strlen(prefix);
+	*first = pack_lower_bound(pack, prefix, length);
+	int end = *first;
+	while (end < pack->count && strncmp(pack_name(pack, end), prefix, length) == 0)
+	{
+		end++;
+	}
+	return end - *first;
+}
+
+const char* pack_name(pack_t pack, int entry)
+{
+	return pack->names + pack->entries[entry].name_offset;
+}
+
+uint64_t pack_hash(pack_t pack, int entry)
+{
+	return pack->entries[entry].hash;
+}
+
+bool pack_verify(pack_t pack, int entry)
+{
+	const struct pack_entry* e = &pack->entries[entry];
+	return dig_hash(pack->view.data + e->offset, e->size) == e->hash;
+}
+
+sprite_t pack_load_sprite(pack_t pack, int entry, arena_t arena, file_status_t* status)
+{
+	const struct pack_entry* e = &pack->entries[entry];
+	file_view_t view = { pack->view.data + e->offset, e->size, 0, NULL, false };
+	return file_load_sprite_view(pack_name(pack, entry), &view, arena, status);
+}
+
+static void pack_load_sprites_job(void* param, int index)
+{
+	struct pack_batch* batch = param;
+	batch->sprites[index] = pack_load_sprite(batch->pack, batch->first + index, batch->arena, &batch->statuses[index]);
+}
+
+int pack_load_sprites(pack_t pack, int first, int count, arena_t arena, sprite_t* sprites, file_status_t* statuses)
+{
+	struct pack_batch batch = { pack, first, arena, sprites, statuses };
+	thread_parallel_for(count, pack_load_sprites_job, &batch);
+
+	int loaded = 0;
+	for (int i = 0; i < count; i++)
+	{
+		loaded += statuses[i] == FILE_STATUS_OK;
+	}
+	return loaded;
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+/*
+	pack.h ~ RL
+
+	Every sprite and layer in one file, opened with a single map. Entries are sorted by name, like "Sprites/foo.txt",
+	so each folder is a contiguous range.
+*/
+
+#pragma once
+
+#include "arena.h"
+#include "file.h"
+#include "types.h"
+
+typedef struct pack* pack_t;
+
+/* Writes the files at paths into output under the matching names. Returns false if any of them can't be read. */
+bool pack_build(const char* output, char** paths, char** names, int count);
+
+pack_t pack_open(const char* path);
+void pack_close(pack_t pack);
+int pack_count(pack_t pack);
+/* Returns the entry with this exact name, or -1 */
+int pack_find(pack_t pack, const char* name);
+/* Returns how many entries start with prefix, first is set to the first of them */
+int pack_range(pack_t pack, const char* prefix, int* first);
+const char* pack_name(pack_t pack, int entry);
+uint64_t pack_hash(pack_t pack, int entry);
+/* Rehashes the entry's contents and compares them against the index */
+bool pack_verify(pack_t pack, int entry);
+/* Same as file_load_sprite_view, parsing straight out of the mapped pack */
+sprite_t pack_load_sprite(pack_t pack, int entry, arena_t arena, file_status_t* status);
+/* Loads count entries from first in parallel, like file_load_sprites */
+int pack_load_sprites(pack_t pack, int first, int count, arena_t arena, sprite_t* sprites, file_status_t* statuses);
\ No newline at end of file
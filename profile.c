@@ -0,0 +1,179 @@
+/*
+	profile.c ~ RL
+*/
+
+#include "profile.h"
+
+#include "log.h"
+#include "thread.h"
+#include <stdio.h>
+
+/*
+	Buckets are exact below 8ns, then every power of two is split into 4, so a bucket is never more
+	than 25% wide. That covers the whole uint64_t range in 252 buckets.
+*/
+#define PROFILE_SUB_BITS 2
+#define PROFILE_LINEAR (1 << (PROFILE_SUB_BITS + 1))
+#define PROFILE_BUCKET_COUNT (PROFILE_LINEAR + (64 - PROFILE_SUB_BITS - 1) * (1 << PROFILE_SUB_BITS))
+
+static const char* phase_names[PROFILE_PHASE_COUNT] = { "load", "index", "decode", "create", "repaint", "render", "present" };
+
+volatile int32_t profile_is_enabled;
+static volatile int32_t buckets[PROFILE_PHASE_COUNT][PROFILE_BUCKET_COUNT];
+
+static inline int profile_log2(uint64_t x)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, x);
+	return (int)index;
+#else
+	return 63 - __builtin_clzll(x);
+#endif
+}
+
+static int profile_bucket(uint64_t ns)
+{
+	if (ns < PROFILE_LINEAR)
+	{
+		return (int)ns;
+	}
+	int exponent = profile_log2(ns);
+	int sub = (int)(ns >> (exponent - PROFILE_SUB_BITS)) & ((1 << PROFILE_SUB_BITS) - 1);
+	return PROFILE_LINEAR + (exponent - PROFILE_SUB_BITS - 1) * (1 << PROFILE_SUB_BITS) + sub;
+}
+
+static uint64_t profile_bucket_lower(int bucket)
+{
+	if (bucket < PROFILE_LINEAR)
+	{
+		return bucket;
+	}
+	int exponent = (bucket - PROFILE_LINEAR) / (1 << PROFILE_SUB_BITS) + PROFILE_SUB_BITS + 1;
+	int sub = (bucket - PROFILE_LINEAR) % (1 << PROFILE_SUB_BITS);
+	return (uint64_t)((1 << PROFILE_SUB_BITS) + sub) << (exponent - PROFILE_SUB_BITS);
+}
+
+/* Middle of the bucket, so a percentile is off by at most half a bucket */
+static uint64_t profile_bucket_middle(int bucket)
+{
+	uint64_t lower = profile_bucket_lower(bucket);
+	return bucket + 1 < PROFILE_BUCKET_COUNT ? lower + (profile_bucket_lower(bucket + 1) - lower) / 2 : lower;
+}
+
+void profile_record(profile_phase_t phase, uint64_t ns)
+{
+	atomic_add32(&buckets[phase][profile_bucket(ns)], 1);
+}
+
+void profile_enable(bool enable)
+{
+	atomic_store32(&profile_is_enabled, enable);
+}
+
+/* Snapshot of a phase's buckets, returns the sample count */
+static uint64_t profile_snapshot(profile_phase_t phase, int32_t* out)
+{
+	uint64_t count = 0;
+	for (int i = 0; i < PROFILE_BUCKET_COUNT; i++)
+	{
+		out[i] = atomic_load32(&buckets[phase][i]);
+		count += out[i];
+	}
+	return count;
+}
+
+static uint64_t profile_percentile(const int32_t* snapshot, uint64_t count, double percentile)
+{
+	uint64_t target = (uint64_t)(count * percentile + 0.5), seen = 0;
+	target = target ? target : 1;
+	for (int i = 0; i < PROFILE_BUCKET_COUNT; i++)
+	{
+		seen += snapshot[i];
+		if (seen >= target)
+		{
+			return profile_bucket_middle(i);
+		}
+	}
+	return 0;
+}
+
+/* At most 5 chars, so the summary of every phase fits in a row */
+static void profile_format_duration(uint64_t ns, char* out, size_t size)
+{
+	if (ns < 1000)
+	{
+		snprintf(out, size, "%ins", (int)ns);
+	}
+	else if (ns < 1000000)
+	{
+		snprintf(out, size, "%ius", (int)(ns / 1000));
+	}
+	else if (ns < 10000000)
+	{
+		snprintf(out, size, "%.1fms", ns / 1e6);
+	}
+	else if (ns < 1000000000)
+	{
+		snprintf(out, size, "%ims", (int)(ns / 1000000));
+	}
+	else
+	{
+		snprintf(out, size, "%.1fs", ns / 1e9);
+	}
+}
+
+void profile_summary(char* out, size_t size)
+{
+	size_t length = 0;
+	out[0] = '\0';
+	for (int phase = 0; phase < PROFILE_PHASE_COUNT && length < size; phase++)
+	{
+		int32_t snapshot[PROFILE_BUCKET_COUNT];
+		uint64_t count = profile_snapshot(phase, snapshot);
+		char p50[16] = "-", p99[16] = "-";
+		if (count)
+		{
+			profile_format_duration(profile_percentile(snapshot, count, 0.5), p50, sizeof p50);
+			profile_format_duration(profile_percentile(snapshot, count, 0.99), p99, sizeof p99);
+		}
+		int written = snprintf(out + length, size - length, "%s%s %s/%s", phase ? "  " : "", phase_names[phase], p50, p99);
+		length += written > 0 ? written : 0;
+	}
+}
+
+bool profile_dump(const char* path)
+{
+	FILE* handle = fopen(path, "w");
+	if (!handle)
+	{
+		log_error("Failed to create \"%s\"\n", path);
+		return false;
+	}
+	for (int phase = 0; phase < PROFILE_PHASE_COUNT; phase++)
+	{
+		int32_t snapshot[PROFILE_BUCKET_COUNT];
+		uint64_t count = profile_snapshot(phase, snapshot);
+		fprintf(handle, "{\"phase\":\"%s\",\"count\":%llu,\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"buckets\":[", phase_names[phase],
+			(unsigned long long)count, (unsigned long long)profile_percentile(snapshot, count, 0.5),
+			(unsigned long long)profile_percentile(snapshot, count, 0.9), (unsigned long long)profile_percentile(snapshot, count, 0.99));
+		/* only the buckets that have samples, as [lowest ns, count] */
+		bool is_first = true;
+		for (int i = 0; i < PROFILE_BUCKET_COUNT; i++)
+		{
+			if (snapshot[i])
+			{
+				fprintf(handle, "%s[%llu,%i]", is_first ? "" : ",", (unsigned long long)profile_bucket_lower(i), (int)snapshot[i]);
+				is_first = false;
+			}
+		}
+		fprintf(handle, "]}\n");
+	}
+	bool ok = !ferror(handle);
+	ok = fclose(handle) == 0 && ok;
+	if (!ok)
+	{
+		log_error("Failed to write \"%s\"\n", path);
+	}
+	return ok;
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+/*
+	profile.h ~ RL
+
+	Timers around the phases of loading and drawing a sprite, collected into one histogram per phase.
+	Nothing is timed until profile_enable, so a timer costs a load and a branch while profiling is off.
+	Building with PROFILE_ENABLED defined as 0 removes them altogether.
+*/
+
+#pragma once
+
+#include "debug.h"
+#include "types.h"
+
+#ifndef PROFILE_ENABLED
+#define PROFILE_ENABLED 1
+#endif
+
+typedef enum profile_phase
+{
+	/* a whole file_load_sprite_view, compiled cache hits included */
+	PROFILE_LOAD,
+	/* finding every section of a file */
+	PROFILE_INDEX,
+	/* turning one plane's text into numbers */
+	PROFILE_DECODE,
+	PROFILE_SPRITE_CREATE,
+	PROFILE_REPAINT,
+	PROFILE_RENDER,
+	/* diffing the frame and writing it to the console */
+	PROFILE_PRESENT,
+	PROFILE_PHASE_COUNT
+} profile_phase_t;
+
+extern volatile int32_t profile_is_enabled;
+
+/* Safe from any thread, samples are recorded with atomics */
+void profile_record(profile_phase_t phase, uint64_t ns);
+
+/* Returns 0 when profiling is off, which makes the matching profile_end do nothing */
+static inline uint64_t profile_begin(void)
+{
+	return PROFILE_ENABLED && profile_is_enabled ? debug_time_ns() : 0;
+}
+
+static inline void profile_end(profile_phase_t phase, uint64_t start)
+{
+	if (PROFILE_ENABLED && start)
+	{
+		profile_record(phase, debug_time_ns() - start);
+	}
+}
+
+void profile_enable(bool enable);
+/* One line of every phase's p50/p99, cut to size */
+void profile_summary(char* out, size_t size);
+/* Writes each phase's count, percentiles and buckets to path as one JSON object per line */
+bool profile_dump(const char* path);
\ No newline at end of file
@@ -1,219 +1,945 @@
 /*
 	screen.c ~ RL
+
+	Platform independent half of the screen module: sprites, the retained frame and palettes.
 */
 
 #include "screen.h"
 
-#include "debug.h"
+#include "blit.h"
 #include "file.h"
+#include "log.h"
+#include "profile.h"
+#include "screen_backend.h"
+#include "store.h"
 #include "types.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <Windows.h>
+#include <string.h>
+
+/* Side of the square chunks big sprites are stored in */
+#define SCREEN_CHUNK_SIZE 32
+/* Sprites are only run-length encoded when their runs average at least this many cells, below it drawing the chunks is faster */
+#define SCREEN_RUN_MIN_AVERAGE 32
+
+/*
+	Kept as separate planes, cells are only built for the visible part of a sprite when it's drawn.
+	Frames are found by offset into the planes, so an animation is one contiguous block.
+
+	Within a frame the text and attribute planes are cut into bands of SCREEN_CHUNK_SIZE rows, and each
+	band into chunks of SCREEN_CHUNK_SIZE columns that are stored one after another, row-major inside.
+	Chunks on the right and bottom edges are just smaller, so nothing is padded and a sprite no bigger
+	than one chunk is plain row-major. Transparency and tile types stay row-major.
+
+	mask has a bit per cell in the same order as the chunked planes, set for cells that are drawn.
+	It's shared by every frame, and NULL when the sprite has no transparent cells.
 
-#define SCREEN_FONT L"digfont9"
-#define RUNTIME_ASSERT(cond) if (!(cond)) exit(-1);
+	The mip planes hold mip_count downsampled copies of the first frame for thumbnails, each half the
+	size of the one before rounded up, back to back and row-major. They're small enough not to need chunks.
+
+	Sprites that are mostly long runs of one cell, like layers, are run-length encoded instead when the runs
+	are long enough to draw faster and at least halve their frames. text, attrib and mask are then NULL, and row y of a frame is the runs from
+	run_rows[frame * height + y] up to the next row's. Transparent cells are the gaps between runs.
+*/
+struct screen_run
+{
+	uint16_t x;
+	uint16_t length;
+	uint8_t ch;
+	/* every attribute CREATE_ATTRIBUTE makes fits a byte, sprites with wider ones aren't encoded */
+	uint8_t attrib;
+};
 
 struct sprite
 {
 	int width, height;
-	CHAR_INFO* data;
+	int frame_count;
+	int palette;
+	attribute_t* attrib;
+	char* text;
+	uint8_t* transparency;
+	uint8_t* tile_type;
+	uint8_t* mask;
+	int mip_count;
+	attribute_t* mip_attrib;
+	char* mip_text;
+	uint32_t* run_rows;
+	struct screen_run* runs;
+	bool is_arena_owned;
+	/* the frames come from the plane store, size is what the sprite added to memory */
+	bool is_stored;
+	size_t size;
 };
 
-static HANDLE in, out;
-static screen_events_t events;
-static CHAR_INFO blank[TARGET_WIDTH * TARGET_HEIGHT];
+screen_events_t screen_events;
 
-static void screen_initialize_output()
+/*
+	Sprites are composited into frame, which is then diffed against what the backend is known
+	to be showing (presented) so only rows that changed are sent.
+*/
+static cell_t frame[TARGET_HEIGHT][TARGET_WIDTH];
+static cell_t presented[TARGET_HEIGHT][TARGET_WIDTH];
+static bool presented_is_valid;
+
+/* Palettes a file can define, ids past it are an error in the file */
+#define SCREEN_PALETTE_MAX 64
+
+/* built in until screen_load_palettes replaces them */
+static uint32_t palettes[SCREEN_PALETTE_MAX][16] =
 {
-	CONSOLE_SCREEN_BUFFER_INFOEX csbi = { .cbSize = sizeof csbi };
-	RUNTIME_ASSERT(GetConsoleScreenBufferInfoEx(out, &csbi));
+	/* default color palette */
+	{ 0x000000, 0x00007F, 0x007F00, 0x007F7F, 0x7F0000, 0x7F007F, 0x7F7F00, 0xC0C0C0, 0x808080, 0x0000FF, 0x00FF00, 0x00FFFF, 0xFF0000, 0xFF00FF, 0xFFFF00, 0xFFFFFF },
+	/* dig-n-rig main color palette */
+	{ 0x000000, 0x4334AC, 0x2C6D43, 0x2D618F, 0x810E2C, 0x612079, 0x956442, 0xA19F9F, 0x615F73, 0x4E83FF, 0x9BE65B, 0x84CDF1, 0xEB2839, 0xDD8CEF, 0xFCEC54, 0xE8E8EE },
+};
+static int palette_count = 2;
+/* -1 until the backend is initialized */
+static int palette_current = -1;
 
-	csbi.dwMaximumWindowSize.X = TARGET_WIDTH;
-	csbi.dwMaximumWindowSize.Y = TARGET_HEIGHT;
-	csbi.dwSize = csbi.dwMaximumWindowSize;
+void screen_initialize(screen_events_t _events)
+{
+	screen_events = _events;
+	screen_backend_initialize();
+	screen_backend_set_palettes(palettes, palette_count);
+	screen_change_color_palette(SCREEN_DEFAULT_PALETTE);
+	screen_invalidate();
+}
 
-	csbi.srWindow.Left = 0;
-	csbi.srWindow.Top = 0;
-	csbi.srWindow.Right = csbi.dwSize.X - 1;
-	csbi.srWindow.Bottom = csbi.dwSize.Y - 1;
+void screen_destroy(void)
+{
+	screen_backend_destroy();
+	palette_current = -1;
+}
 
-	RUNTIME_ASSERT(SetConsoleScreenBufferInfoEx(out, &csbi));
+void screen_loop(void)
+{
+	screen_backend_loop();
+}
 
-	screen_change_color_palette(1);
+void screen_wake(void)
+{
+	screen_backend_wake();
 }
 
-static void screen_initialize_cursor(void)
+void screen_invalidate(void)
 {
-	CONSOLE_CURSOR_INFO cci;
-	RUNTIME_ASSERT(GetConsoleCursorInfo(out, &cci));
-	cci.bVisible = FALSE;
-	RUNTIME_ASSERT(SetConsoleCursorInfo(out, &cci));
+	presented_is_valid = false;
 }
 
-void screen_initialize(screen_events_t _events)
+/* Finds the changed columns of a row, returns false if the row is unchanged */
+static bool screen_row_dirty_span(int y, int* left, int* right)
 {
-	in = GetStdHandle(STD_INPUT_HANDLE);
-	RUNTIME_ASSERT(in != INVALID_HANDLE_VALUE && in);
+	if (presented_is_valid && memcmp(frame[y], presented[y], sizeof frame[y]) == 0)
+	{
+		return false;
+	}
+	if (!presented_is_valid)
+	{
+		*left = 0;
+		*right = TARGET_WIDTH;
+		return true;
+	}
+	int l = 0, r = TARGET_WIDTH;
+	while (memcmp(&frame[y][l], &presented[y][l], sizeof frame[y][l]) == 0)
+	{
+		l++;
+	}
+	while (memcmp(&frame[y][r - 1], &presented[y][r - 1], sizeof frame[y][r - 1]) == 0)
+	{
+		r--;
+	}
+	*left = l;
+	*right = r;
+	return true;
+}
 
-	out = CreateConsoleScreenBuffer(GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, CONSOLE_TEXTMODE_BUFFER, NULL);
-	RUNTIME_ASSERT(out != INVALID_HANDLE_VALUE);
+/* Runs of dirty rows are merged into one region spanning their changed columns, and all regions go to the backend at once */
+static void screen_present(void)
+{
+	screen_region_t regions[TARGET_HEIGHT];
+	int count = 0;
+	int y = 0;
+	while (y < TARGET_HEIGHT)
+	{
+		int left, right;
+		if (!screen_row_dirty_span(y, &left, &right))
+		{
+			y++;
+			continue;
+		}
+		int top = y++;
+		int row_left, row_right;
+		while (y < TARGET_HEIGHT && screen_row_dirty_span(y, &row_left, &row_right))
+		{
+			left = row_left < left ? row_left : left;
+			right = row_right > right ? row_right : right;
+			y++;
+		}
+		regions[count++] = (screen_region_t){ left, top, right, y };
+	}
+
+	if (count > 0)
+	{
+		screen_backend_present(frame, regions, count);
+	}
+	for (int i = 0; i < count; i++)
+	{
+		for (int row = regions[i].top; row < regions[i].bottom; row++)
+		{
+			memcpy(&presented[row][regions[i].left], &frame[row][regions[i].left], (regions[i].right - regions[i].left) * sizeof * frame[row]);
+		}
+	}
+	presented_is_valid = true;
+}
+
+void screen_repaint(void)
+{
+	uint64_t start = profile_begin();
+	memset(frame, 0, sizeof frame);
+	screen_events.repaint();
+	uint64_t present_start = profile_begin();
+	screen_present();
+	profile_end(PROFILE_PRESENT, present_start);
+	profile_end(PROFILE_REPAINT, start);
+}
+
+void screen_change_title(const char* title)
+{
+	screen_backend_change_title(title);
+}
+
+void screen_change_color_palette(int id)
+{
+	if (id < 0 || id >= palette_count)
+	{
+		log_warning("Unknown color palette %i\n", id);
+		return;
+	}
+	if (id == palette_current)
+	{
+		return;
+	}
+	palette_current = id;
+	screen_backend_change_palette(id);
+}
 
-	screen_initialize_output();
+/* Reads 16 hex colors from line into colors, returns false unless that's all the line holds */
+static bool screen_parse_palette(const char* line, uint32_t colors[16])
+{
+	for (int i = 0; i < 16; i++)
+	{
+		char* end;
+		unsigned long color = strtoul(line, &end, 16);
+		if (end == line || color > 0xFFFFFF)
+		{
+			return false;
+		}
+		colors[i] = (uint32_t)color;
+		line = end;
+	}
+	line += strspn(line, " \t\r\n");
+	return *line == '\0';
+}
 
-	CONSOLE_FONT_INFOEX cfi = { .cbSize = sizeof cfi };
-	RUNTIME_ASSERT(GetCurrentConsoleFontEx(out, FALSE, &cfi));
+bool screen_load_palettes(const char* path)
+{
+	FILE* handle = fopen(path, "r");
+	if (!handle)
+	{
+		log_error("Couldn't open palettes \"%s\"\n", path);
+		return false;
+	}
+	uint32_t loaded[SCREEN_PALETTE_MAX][16];
+	int count = 0, line_number = 0;
+	bool res = true;
+	char line[512];
+	while (res && fgets(line, sizeof line, handle))
+	{
+		line_number++;
+		const char* start = line + strspn(line, " \t\r\n");
+		if (*start == '\0' || *start == '#')
+		{
+			continue;
+		}
+		res = count < SCREEN_PALETTE_MAX && screen_parse_palette(start, loaded[count]);
+		count += res;
+	}
+	fclose(handle);
+	if (!res)
+	{
+		log_error("Line %i of palettes \"%s\" isn't 16 RRGGBB colors, or there are more than %i palettes\n", line_number, path, SCREEN_PALETTE_MAX);
+		return false;
+	}
+	if (count <= SCREEN_DEFAULT_PALETTE)
+	{
+		log_error("Palettes \"%s\" need at least %i palettes, the default is id %i\n", path, SCREEN_DEFAULT_PALETTE + 1, SCREEN_DEFAULT_PALETTE);
+		return false;
+	}
 
-	cfi.dwFontSize = (COORD){ TARGET_CELL_SIZE - 1, TARGET_CELL_SIZE };
-	cfi.FontFamily = FF_DONTCARE;
-	cfi.nFont = 0;
-	swprintf(cfi.FaceName, sizeof cfi.FaceName / sizeof * cfi.FaceName, SCREEN_FONT);
+	memcpy(palettes, loaded, count * sizeof * loaded);
+	palette_count = count;
+	if (palette_current >= 0)
+	{
+		/* the backend's tables are rebuilt, then whatever was showing is switched to again */
+		int id = palette_current < palette_count ? palette_current : SCREEN_DEFAULT_PALETTE;
+		screen_backend_set_palettes(palettes, palette_count);
+		palette_current = -1;
+		screen_change_color_palette(id);
+	}
+	return true;
+}
 
-	RUNTIME_ASSERT(SetCurrentConsoleFontEx(out, FALSE, &cfi));
+int screen_palette_count(void)
+{
+	return palette_count;
+}
 
-	RUNTIME_ASSERT(SetConsoleActiveScreenBuffer(out));
+const uint32_t* screen_palette(int id)
+{
+	return id >= 0 && id < palette_count ? palettes[id] : NULL;
+}
 
-	RUNTIME_ASSERT(SetConsoleMode(in, ENABLE_WINDOW_INPUT | ENABLE_MOUSE_INPUT));
-	RUNTIME_ASSERT(SetConsoleMode(out, 0));
-	
-	screen_initialize_cursor();
-	events = _events;
+static inline size_t screen_mask_size(size_t cells)
+{
+	return (cells + 7) / 8 + BLIT_MASK_PADDING;
+}
 
-	RUNTIME_ASSERT(GetCurrentConsoleFontEx(out, FALSE, &cfi));
+static bool screen_has_transparency(const sprite_data_t* data)
+{
+	size_t cells = (size_t)data->width * data->height;
+	for (size_t i = 0; data->transparency && i < cells; i++)
+	{
+		if (data->transparency[i])
+		{
+			return true;
+		}
+	}
+	return false;
+}
 
-	if (wcsncmp(cfi.FaceName, SCREEN_FONT, sizeof cfi.FaceName / sizeof * cfi.FaceName) != 0)
+/* Packs the row-major transparency plane into a bit mask in chunk order */
+static void screen_build_mask(sprite_t sprite, const uint8_t* transparency)
+{
+	size_t cells = (size_t)sprite->width * sprite->height;
+	memset(sprite->mask, 0, screen_mask_size(cells));
+	size_t offset = 0;
+	for (int band = 0; band < sprite->height; band += SCREEN_CHUNK_SIZE)
 	{
-		debug_format("Failed to locate Dig-N-Rig's font!\n");
+		int band_height = sprite->height - band < SCREEN_CHUNK_SIZE ? sprite->height - band : SCREEN_CHUNK_SIZE;
+		for (int chunk = 0; chunk < sprite->width; chunk += SCREEN_CHUNK_SIZE)
+		{
+			int chunk_width = sprite->width - chunk < SCREEN_CHUNK_SIZE ? sprite->width - chunk : SCREEN_CHUNK_SIZE;
+			for (int row = band; row < band + band_height; row++)
+			{
+				for (int column = chunk; column < chunk + chunk_width; column++, offset++)
+				{
+					sprite->mask[offset >> 3] |= (transparency[(size_t)row * sprite->width + column] == 0) << (offset & 7);
+				}
+			}
+		}
 	}
 }
 
-void screen_destroy(void)
+/* Cells in every mip level below a width by height sprite, down to a single cell */
+static size_t screen_mip_cells(int width, int height, int* count)
 {
-	CloseHandle(out);
+	size_t res = 0;
+	*count = 0;
+	while (width > 1 || height > 1)
+	{
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+		res += (size_t)width * height;
+		(*count)++;
+	}
+	return res;
 }
 
-void screen_loop(void)
+/*
+	Halves a row-major plane, each cell taking the char and attribute pair that's most common in its
+	2x2 block so lines and fills survive better than with a fixed pick. Ties go to cells that aren't blank.
+	Cells flagged in transparency count as blank.
+*/
+static void screen_mip_reduce(int width, int height, const char* text, const attribute_t* attrib, const uint8_t* transparency, char* out_text, attribute_t* out_attrib)
 {
-	INPUT_RECORD ir;
-	DWORD read;
-	while (ReadConsoleInputW(in, &ir, 1, &read) && read == 1)
+	int out_width = (width + 1) / 2, out_height = (height + 1) / 2;
+	for (int y = 0; y < out_height; y++)
 	{
-		if (ir.EventType == KEY_EVENT)
+		for (int x = 0; x < out_width; x++)
 		{
-			KEY_EVENT_RECORD ker = ir.Event.KeyEvent;
-			if (!ker.bKeyDown)
+			char block_text[4];
+			attribute_t block_attrib[4];
+			int count = 0;
+			for (int row = y * 2; row < y * 2 + 2 && row < height; row++)
 			{
-				continue;
+				for (int column = x * 2; column < x * 2 + 2 && column < width; column++, count++)
+				{
+					size_t i = (size_t)row * width + column;
+					bool is_hidden = transparency && transparency[i];
+					block_text[count] = is_hidden ? 0 : text[i];
+					block_attrib[count] = is_hidden ? 0 : attrib[i];
+				}
 			}
-			if (ker.wVirtualKeyCode == VK_ESCAPE)
+			int best = 0, best_score = -1;
+			for (int i = 0; i < count; i++)
 			{
-				break;
+				int score = block_text[i] != 0 && block_text[i] != ' ';
+				for (int j = 0; j < count; j++)
+				{
+					score += (block_text[i] == block_text[j] && block_attrib[i] == block_attrib[j]) * 2;
+				}
+				if (score > best_score)
+				{
+					best = i;
+					best_score = score;
+				}
 			}
-			events.keyboard(ker.wVirtualKeyCode);
+			out_text[(size_t)y * out_width + x] = block_text[best];
+			out_attrib[(size_t)y * out_width + x] = block_attrib[best];
 		}
-		else if (ir.EventType == WINDOW_BUFFER_SIZE_EVENT)
-		{
-			HWND console_window = GetConsoleWindow();
+	}
+}
 
-			RECT fitted = (RECT){ .right = TARGET_WIDTH * TARGET_CELL_SIZE, .bottom = TARGET_HEIGHT * TARGET_CELL_SIZE };
-			RUNTIME_ASSERT(AdjustWindowRectEx(&fitted, GetWindowLongW(console_window, GWL_STYLE), FALSE, GetWindowLongW(console_window, GWL_EXSTYLE)));
+static void screen_build_mips(sprite_t sprite, const sprite_data_t* data)
+{
+	int width = data->width, height = data->height;
+	const char* text = data->text;
+	const attribute_t* attrib = data->attrib;
+	const uint8_t* transparency = data->transparency;
+	size_t offset = 0;
+	for (int level = 0; level < sprite->mip_count; level++)
+	{
+		screen_mip_reduce(width, height, text, attrib, transparency, sprite->mip_text + offset, sprite->mip_attrib + offset);
+		text = sprite->mip_text + offset;
+		attrib = sprite->mip_attrib + offset;
+		transparency = NULL;
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+		offset += (size_t)width * height;
+	}
+}
 
-			RUNTIME_ASSERT(SetWindowPos(console_window, NULL, 0, 0, fitted.right - fitted.left, fitted.bottom - fitted.top, SWP_NOMOVE));
-			screen_initialize_cursor();
-			screen_repaint();
+/* Run-length encoding needs narrow attributes and run positions that fit 16 bits */
+static bool screen_runs_fit(const sprite_data_t* data)
+{
+	if (data->width > UINT16_MAX)
+	{
+		return false;
+	}
+	size_t frame_cells = (size_t)data->width * data->height * data->frame_count;
+	for (size_t i = 0; i < frame_cells; i++)
+	{
+		if (data->attrib[i] > UINT8_MAX)
+		{
+			return false;
+		}
+	}
+	return true;
+}
 
-			CONSOLE_SCREEN_BUFFER_INFOEX csbi = { .cbSize = sizeof csbi };
-			RUNTIME_ASSERT(GetConsoleScreenBufferInfoEx(out, &csbi));
-			if (csbi.dwSize.X != TARGET_WIDTH || csbi.dwSize.Y != TARGET_HEIGHT)
+/* Returns the number of runs the frames encode to, and writes them unless rows and runs are NULL */
+static size_t screen_encode_runs(const sprite_data_t* data, uint32_t* rows, struct screen_run* runs)
+{
+	size_t count = 0;
+	for (int row = 0; row < data->frame_count * data->height; row++)
+	{
+		const char* text = data->text + (size_t)row * data->width;
+		const attribute_t* attrib = data->attrib + (size_t)row * data->width;
+		const uint8_t* transparency = data->transparency ? data->transparency + (size_t)(row % data->height) * data->width : NULL;
+		if (rows)
+		{
+			rows[row] = (uint32_t)count;
+		}
+		for (int x = 0, end; x < data->width; x = end)
+		{
+			end = x + 1;
+			if (transparency && transparency[x])
+			{
+				continue;
+			}
+			while (end < data->width && text[end] == text[x] && attrib[end] == attrib[x] && !(transparency && transparency[end]))
+			{
+				end++;
+			}
+			if (runs)
 			{
-				screen_initialize_output();
+				runs[count] = (struct screen_run) { (uint16_t)x, (uint16_t)(end - x), (uint8_t)text[x], (uint8_t)attrib[x] };
 			}
+			count++;
 		}
 	}
+	if (rows)
+	{
+		rows[data->frame_count * data->height] = (uint32_t)count;
+	}
+	return count;
 }
 
-void screen_repaint(void)
+sprite_t screen_sprite_create(int width, int height, char* text, attribute_t* attrib)
 {
-	SMALL_RECT window_size = { .Top = 0, .Left = 0, .Right = TARGET_WIDTH, .Bottom = TARGET_HEIGHT };
-	WriteConsoleOutputW(out, blank, (COORD) { TARGET_WIDTH, TARGET_HEIGHT }, (COORD) { 0, 0 }, & window_size);
-	events.repaint();
+	return screen_sprite_create_frames(&(sprite_data_t) { width, height, 1, -1, text, attrib, NULL, NULL }, NULL);
 }
 
-void screen_change_title(const char* title)
+/* Where each of the sprite's planes is, NULL for the ones it doesn't have */
+static void screen_sprite_planes(sprite_t sprite, void* planes[SPRITE_PLANE_COUNT])
 {
-	RUNTIME_ASSERT(SetConsoleTitleA(title));
+	planes[SPRITE_PLANE_ATTRIB] = sprite->attrib;
+	planes[SPRITE_PLANE_TEXT] = sprite->text;
+	planes[SPRITE_PLANE_RUNS] = sprite->run_rows;
+	planes[SPRITE_PLANE_MIP_ATTRIB] = sprite->mip_count ? sprite->mip_attrib : NULL;
+	planes[SPRITE_PLANE_MIP_TEXT] = sprite->mip_count ? sprite->mip_text : NULL;
+	planes[SPRITE_PLANE_TRANSPARENCY] = sprite->transparency;
+	planes[SPRITE_PLANE_TILE_TYPE] = sprite->tile_type;
+	planes[SPRITE_PLANE_MASK] = sprite->mask;
 }
 
-void screen_change_color_palette(int id)
+/*
+	Allocates a sprite with room for planes of the sizes in layout, which are left for the caller to fill.
+	Heap sprites take their frames from the plane store so identical ones are shared, until screen_sprite_finish
+	commits them. Everything else shares one allocation with the header, attributes first to keep them aligned.
+*/
+static sprite_t screen_sprite_allocate(const sprite_image_t* layout, arena_t arena)
 {
-	CONSOLE_SCREEN_BUFFER_INFOEX csbi = { .cbSize = sizeof csbi };
-	RUNTIME_ASSERT(GetConsoleScreenBufferInfoEx(out, &csbi));
+	const size_t* sizes = layout->sizes;
+	bool is_stored = arena == NULL;
+	bool is_encoded = sizes[SPRITE_PLANE_RUNS] != 0;
+	size_t frame_bytes = is_encoded ? sizes[SPRITE_PLANE_RUNS] : sizes[SPRITE_PLANE_ATTRIB] + sizes[SPRITE_PLANE_TEXT];
+	size_t size = sizeof(struct sprite) + (is_stored ? 0 : frame_bytes) + sizes[SPRITE_PLANE_MIP_ATTRIB] + sizes[SPRITE_PLANE_MIP_TEXT]
+		+ sizes[SPRITE_PLANE_TRANSPARENCY] + sizes[SPRITE_PLANE_TILE_TYPE] + sizes[SPRITE_PLANE_MASK];
+	sprite_t res = arena ? arena_alloc(arena, size) : dig_malloc(size);
+	res->is_arena_owned = arena != NULL;
+	res->is_stored = is_stored;
+	res->width = layout->width;
+	res->height = layout->height;
+	res->frame_count = layout->frame_count;
+	res->palette = layout->palette;
+	screen_mip_cells(res->width, res->height, &res->mip_count);
+	/* stored frames aren't counted here, whoever holds sprites charges for them once per plane through screen_sprite_stored_planes */
+	res->size = size;
+	res->attrib = NULL;
+	res->text = NULL;
+	res->run_rows = NULL;
+	res->runs = NULL;
+
+	uint8_t* next = (uint8_t*)(res + 1);
+	if (is_encoded)
+	{
+		res->run_rows = is_stored ? store_reserve(sizes[SPRITE_PLANE_RUNS]) : (uint32_t*)next;
+		next += is_stored ? 0 : sizes[SPRITE_PLANE_RUNS];
+	}
+	else
+	{
+		res->attrib = is_stored ? store_reserve(sizes[SPRITE_PLANE_ATTRIB]) : (attribute_t*)next;
+		next += is_stored ? 0 : sizes[SPRITE_PLANE_ATTRIB];
+	}
+	res->mip_attrib = (attribute_t*)next;
+	next += sizes[SPRITE_PLANE_MIP_ATTRIB];
+	if (!is_encoded)
+	{
+		res->text = is_stored ? store_reserve(sizes[SPRITE_PLANE_TEXT]) : (char*)next;
+		next += is_stored ? 0 : sizes[SPRITE_PLANE_TEXT];
+	}
+	res->mip_text = (char*)next;
+	next += sizes[SPRITE_PLANE_MIP_TEXT];
+	res->transparency = sizes[SPRITE_PLANE_TRANSPARENCY] ? next : NULL;
+	next += sizes[SPRITE_PLANE_TRANSPARENCY];
+	res->tile_type = sizes[SPRITE_PLANE_TILE_TYPE] ? next : NULL;
+	next += sizes[SPRITE_PLANE_TILE_TYPE];
+	res->mask = sizes[SPRITE_PLANE_MASK] ? next : NULL;
+	return res;
+}
 
-	switch (id)
+/* Once the frames are filled in, hands them to the plane store, which may swap in an identical copy it already has */
+static void screen_sprite_finish(sprite_t sprite)
+{
+	if (sprite->is_stored)
 	{
-	case 0: /* default color palette */
-		for (int i = 0; i < 16; i++)
+		if (sprite->run_rows)
+		{
+			sprite->run_rows = store_commit(sprite->run_rows);
+		}
+		else
 		{
-			int intensity = !!(i & 8) * 128 + 127;
-			csbi.ColorTable[i] = RGB(!!(i & 4) * intensity, !!(i & 2) * intensity, !!(i & 1) * intensity);
+			sprite->attrib = store_commit(sprite->attrib);
+			sprite->text = store_commit(sprite->text);
 		}
-		csbi.ColorTable[LIGHT_GRAY] = RGB(192, 192, 192);
-		csbi.ColorTable[DARK_GRAY] = RGB(128, 128, 128);
-		break;
-	case 1: /* dig-n-rig main color palette */
-		csbi.ColorTable[0] = RGB(0, 0, 0);
-		csbi.ColorTable[1] = RGB(67, 52, 172);
-		csbi.ColorTable[2] = RGB(44, 109, 67);
-		csbi.ColorTable[3] = RGB(45, 97, 143);
-		csbi.ColorTable[4] = RGB(129, 14, 44);
-		csbi.ColorTable[5] = RGB(97, 32, 121);
-		csbi.ColorTable[6] = RGB(149, 100, 66);
-		csbi.ColorTable[7] = RGB(161, 159, 159);
-		csbi.ColorTable[8] = RGB(97, 95, 115);
-		csbi.ColorTable[9] = RGB(78, 131, 255);
-		csbi.ColorTable[10] = RGB(155, 230, 91);
-		csbi.ColorTable[11] = RGB(132, 205, 241);
-		csbi.ColorTable[12] = RGB(235, 40, 57);
-		csbi.ColorTable[13] = RGB(221, 140, 239);
-		csbi.ColorTable[14] = RGB(252, 236, 84);
-		csbi.ColorTable[15] = RGB(232, 232, 238);
-		break;
 	}
+	sprite->runs = sprite->run_rows ? (struct screen_run*)(sprite->run_rows + (size_t)sprite->frame_count * sprite->height + 1) : NULL;
+}
 
-	RUNTIME_ASSERT(SetConsoleScreenBufferInfoEx(out, &csbi));
+sprite_t screen_sprite_create_frames(const sprite_data_t* data, arena_t arena)
+{
+	RUNTIME_ASSERT(data->text && data->attrib && data->frame_count > 0);
+	uint64_t start = profile_begin();
+	size_t cells = (size_t)data->width * data->height;
+	size_t frame_cells = cells * data->frame_count;
+	size_t mask_size = screen_has_transparency(data) ? screen_mask_size(cells) : 0;
+	int mip_count;
+	size_t mip_cells = screen_mip_cells(data->width, data->height, &mip_count);
+	size_t dense_bytes = frame_cells * (sizeof * data->attrib + sizeof * data->text);
+	size_t row_count = (size_t)data->frame_count * data->height + 1;
+	size_t run_count = screen_runs_fit(data) ? screen_encode_runs(data, NULL, NULL) : SIZE_MAX;
+	size_t run_bytes = row_count * sizeof(uint32_t) + run_count * sizeof(struct screen_run);
+	bool is_encoded = run_count <= frame_cells / SCREEN_RUN_MIN_AVERAGE && run_bytes <= (dense_bytes + mask_size) / 2;
+
+	sprite_image_t layout = { .width = data->width, .height = data->height, .frame_count = data->frame_count, .palette = data->palette };
+	layout.sizes[SPRITE_PLANE_ATTRIB] = is_encoded ? 0 : frame_cells * sizeof * data->attrib;
+	layout.sizes[SPRITE_PLANE_TEXT] = is_encoded ? 0 : frame_cells * sizeof * data->text;
+	layout.sizes[SPRITE_PLANE_RUNS] = is_encoded ? run_bytes : 0;
+	layout.sizes[SPRITE_PLANE_MIP_ATTRIB] = mip_cells * sizeof * data->attrib;
+	layout.sizes[SPRITE_PLANE_MIP_TEXT] = mip_cells * sizeof * data->text;
+	layout.sizes[SPRITE_PLANE_TRANSPARENCY] = data->transparency ? cells : 0;
+	layout.sizes[SPRITE_PLANE_TILE_TYPE] = data->tile_type ? cells : 0;
+	layout.sizes[SPRITE_PLANE_MASK] = is_encoded ? 0 : mask_size;
+	sprite_t res = screen_sprite_allocate(&layout, arena);
+
+	if (is_encoded)
+	{
+		screen_encode_runs(data, res->run_rows, (struct screen_run*)(res->run_rows + row_count));
+	}
+	for (int index = 0; index < data->frame_count && !is_encoded; index++)
+	{
+		size_t base = index * cells;
+		for (int band = 0; band < res->height; band += SCREEN_CHUNK_SIZE)
+		{
+			int band_height = res->height - band < SCREEN_CHUNK_SIZE ? res->height - band : SCREEN_CHUNK_SIZE;
+			for (int chunk = 0; chunk < res->width; chunk += SCREEN_CHUNK_SIZE)
+			{
+				int chunk_width = res->width - chunk < SCREEN_CHUNK_SIZE ? res->width - chunk : SCREEN_CHUNK_SIZE;
+				size_t offset = base + (size_t)band * res->width + (size_t)chunk * band_height;
+				for (int row = band; row < band + band_height; row++, offset += chunk_width)
+				{
+					size_t source = base + (size_t)row * res->width + chunk;
+					memcpy(res->attrib + offset, data->attrib + source, chunk_width * sizeof * data->attrib);
+					memcpy(res->text + offset, data->text + source, chunk_width * sizeof * data->text);
+				}
+			}
+		}
+	}
+	screen_sprite_finish(res);
+
+	screen_build_mips(res, data);
+	if (res->transparency)
+	{
+		memcpy(res->transparency, data->transparency, cells);
+	}
+	if (res->tile_type)
+	{
+		memcpy(res->tile_type, data->tile_type, cells);
+	}
+	if (res->mask)
+	{
+		screen_build_mask(res, data->transparency);
+	}
+	profile_end(PROFILE_SPRITE_CREATE, start);
+	return res;
 }
 
-sprite_t screen_sprite_create(int width, int height, char* text, attribute_t* attrib)
+/* Runs have to stay inside their rows and the rows inside the runs, or drawing would read past them */
+static bool screen_runs_are_valid(const sprite_image_t* image)
 {
-	RUNTIME_ASSERT(text && attrib);
-	sprite_t res = dig_malloc(sizeof * res);
-	res->width = width;
-	res->height = height;
-	res->data = dig_malloc(width * height * sizeof * res->data);
-	for (int i = 0; i < width * height; i++)
+	size_t row_count = (size_t)image->frame_count * image->height + 1;
+	size_t size = image->sizes[SPRITE_PLANE_RUNS];
+	if (size < row_count * sizeof(uint32_t) || (size - row_count * sizeof(uint32_t)) % sizeof(struct screen_run) != 0)
+	{
+		return false;
+	}
+	size_t run_count = (size - row_count * sizeof(uint32_t)) / sizeof(struct screen_run);
+	const uint32_t* rows = image->planes[SPRITE_PLANE_RUNS];
+	const struct screen_run* runs = (const struct screen_run*)(rows + row_count);
+	if (rows[0] != 0 || rows[row_count - 1] != run_count)
 	{
-		res->data[i].Char.AsciiChar = text[i];
-		res->data[i].Attributes = attrib[i];
+		return false;
 	}
+	for (size_t row = 1; row < row_count; row++)
+	{
+		if (rows[row] < rows[row - 1])
+		{
+			return false;
+		}
+	}
+	for (size_t i = 0; i < run_count; i++)
+	{
+		if (runs[i].length == 0 || runs[i].x + runs[i].length > image->width)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool screen_image_is_valid(const sprite_image_t* image)
+{
+	const size_t* sizes = image->sizes;
+	if (image->width <= 0 || image->height <= 0 || image->frame_count <= 0
+		|| (size_t)image->width > SIZE_MAX / image->height
+		|| (size_t)image->width * image->height > SIZE_MAX / sizeof(attribute_t) / image->frame_count)
+	{
+		return false;
+	}
+	for (int plane = 0; plane < SPRITE_PLANE_COUNT; plane++)
+	{
+		if (!sizes[plane] != !image->planes[plane])
+		{
+			return false;
+		}
+	}
+	size_t cells = (size_t)image->width * image->height;
+	size_t frame_cells = cells * image->frame_count;
+	int mip_count;
+	size_t mip_cells = screen_mip_cells(image->width, image->height, &mip_count);
+	bool is_encoded = sizes[SPRITE_PLANE_RUNS] != 0;
+	bool are_frames_valid = is_encoded
+		? !sizes[SPRITE_PLANE_ATTRIB] && !sizes[SPRITE_PLANE_TEXT] && !sizes[SPRITE_PLANE_MASK] && screen_runs_are_valid(image)
+		: sizes[SPRITE_PLANE_ATTRIB] == frame_cells * sizeof(attribute_t) && sizes[SPRITE_PLANE_TEXT] == frame_cells;
+	return are_frames_valid
+		&& sizes[SPRITE_PLANE_MIP_ATTRIB] == mip_cells * sizeof(attribute_t)
+		&& sizes[SPRITE_PLANE_MIP_TEXT] == mip_cells
+		&& (!sizes[SPRITE_PLANE_TRANSPARENCY] || sizes[SPRITE_PLANE_TRANSPARENCY] == cells)
+		&& (!sizes[SPRITE_PLANE_TILE_TYPE] || sizes[SPRITE_PLANE_TILE_TYPE] == cells)
+		&& (!sizes[SPRITE_PLANE_MASK] || sizes[SPRITE_PLANE_MASK] == screen_mask_size(cells));
+}
+
+sprite_t screen_sprite_create_image(const sprite_image_t* image, arena_t arena)
+{
+	if (!screen_image_is_valid(image))
+	{
+		return NULL;
+	}
+	uint64_t start = profile_begin();
+	sprite_t res = screen_sprite_allocate(image, arena);
+	void* planes[SPRITE_PLANE_COUNT];
+	screen_sprite_planes(res, planes);
+	for (int plane = 0; plane < SPRITE_PLANE_COUNT; plane++)
+	{
+		if (image->sizes[plane])
+		{
+			memcpy(planes[plane], image->planes[plane], image->sizes[plane]);
+		}
+	}
+	screen_sprite_finish(res);
+	profile_end(PROFILE_SPRITE_CREATE, start);
 	return res;
 }
 
+void screen_sprite_image(sprite_t sprite, sprite_image_t* image)
+{
+	RUNTIME_ASSERT(sprite);
+	size_t cells = (size_t)sprite->width * sprite->height;
+	size_t frame_cells = cells * sprite->frame_count;
+	int mip_count;
+	size_t mip_cells = screen_mip_cells(sprite->width, sprite->height, &mip_count);
+	size_t row_count = (size_t)sprite->frame_count * sprite->height + 1;
+	image->width = sprite->width;
+	image->height = sprite->height;
+	image->frame_count = sprite->frame_count;
+	image->palette = sprite->palette;
+	void* planes[SPRITE_PLANE_COUNT];
+	screen_sprite_planes(sprite, planes);
+	for (int plane = 0; plane < SPRITE_PLANE_COUNT; plane++)
+	{
+		image->planes[plane] = planes[plane];
+	}
+	image->sizes[SPRITE_PLANE_ATTRIB] = sprite->attrib ? frame_cells * sizeof * sprite->attrib : 0;
+	image->sizes[SPRITE_PLANE_TEXT] = sprite->text ? frame_cells : 0;
+	image->sizes[SPRITE_PLANE_RUNS] = sprite->run_rows ? row_count * sizeof(uint32_t) + sprite->run_rows[row_count - 1] * sizeof(struct screen_run) : 0;
+	image->sizes[SPRITE_PLANE_MIP_ATTRIB] = mip_cells * sizeof * sprite->mip_attrib;
+	image->sizes[SPRITE_PLANE_MIP_TEXT] = mip_cells;
+	image->sizes[SPRITE_PLANE_TRANSPARENCY] = sprite->transparency ? cells : 0;
+	image->sizes[SPRITE_PLANE_TILE_TYPE] = sprite->tile_type ? cells : 0;
+	image->sizes[SPRITE_PLANE_MASK] = sprite->mask ? screen_mask_size(cells) : 0;
+}
+
 void screen_sprite_destroy(sprite_t sprite)
 {
-	if (!sprite)
+	if (sprite && sprite->is_arena_owned)
 	{
 		return;
 	}
-	free(sprite->data);
+	if (sprite && sprite->is_stored)
+	{
+		store_release(sprite->attrib);
+		store_release(sprite->text);
+		store_release(sprite->run_rows);
+	}
 	free(sprite);
 }
 
 void screen_sprite_render(int x, int y, sprite_t sprite)
+{
+	screen_sprite_render_frame(x, y, sprite, 0);
+}
+
+/* Fills the runs of an encoded row that overlap columns [left, right) into dst, which is where column left goes */
+static void screen_render_runs(cell_t* dst, sprite_t sprite, int row, int left, int right)
+{
+	const struct screen_run* run = sprite->runs + sprite->run_rows[row];
+	const struct screen_run* end = sprite->runs + sprite->run_rows[row + 1];
+	/* the first run that ends past left */
+	for (size_t count = end - run; count > 0;)
+	{
+		size_t half = count / 2;
+		if (run[half].x + run[half].length <= left)
+		{
+			run += half + 1;
+			count -= half + 1;
+		}
+		else
+		{
+			count = half;
+		}
+	}
+	for (; run < end && run->x < right; run++)
+	{
+		int begin = run->x > left ? run->x : left;
+		int finish = run->x + run->length < right ? run->x + run->length : right;
+		blit_fill(dst + (begin - left), (cell_t) { run->ch, run->attrib }, finish - begin);
+	}
+}
+
+void screen_sprite_render_frame(int x, int y, sprite_t sprite, int index)
 {
 	RUNTIME_ASSERT(sprite);
-	SMALL_RECT write_region = { .Left = x, .Top = y, .Right = x + sprite->width, .Bottom = y + sprite->height };
-	RUNTIME_ASSERT(WriteConsoleOutputA(out, sprite->data, (COORD) { sprite->width, sprite->height }, (COORD) { 0, 0 }, &write_region));
+	int left = x < 0 ? 0 : x, top = y < 0 ? 0 : y;
+	int right = x + sprite->width > TARGET_WIDTH ? TARGET_WIDTH : x + sprite->width;
+	int bottom = y + sprite->height > TARGET_HEIGHT ? TARGET_HEIGHT : y + sprite->height;
+	if (left >= right)
+	{
+		return;
+	}
+	uint64_t start = profile_begin();
+	index = (index % sprite->frame_count + sprite->frame_count) % sprite->frame_count;
+	if (sprite->runs)
+	{
+		for (int row = top; row < bottom; row++)
+		{
+			screen_render_runs(&frame[row][left], sprite, index * sprite->height + row - y, left - x, right - x);
+		}
+		profile_end(PROFILE_RENDER, start);
+		return;
+	}
+	size_t base = (size_t)index * sprite->width * sprite->height;
+
+	/* only the chunks under the screen are visited, so a huge layer costs the same as a small one */
+	int visible_left = left - x, visible_right = right - x, visible_top = top - y, visible_bottom = bottom - y;
+	for (int band = visible_top & ~(SCREEN_CHUNK_SIZE - 1); band < visible_bottom; band += SCREEN_CHUNK_SIZE)
+	{
+		int band_height = sprite->height - band < SCREEN_CHUNK_SIZE ? sprite->height - band : SCREEN_CHUNK_SIZE;
+		int row_begin = band > visible_top ? band : visible_top;
+		int row_end = band + band_height < visible_bottom ? band + band_height : visible_bottom;
+		for (int chunk = visible_left & ~(SCREEN_CHUNK_SIZE - 1); chunk < visible_right; chunk += SCREEN_CHUNK_SIZE)
+		{
+			int chunk_width = sprite->width - chunk < SCREEN_CHUNK_SIZE ? sprite->width - chunk : SCREEN_CHUNK_SIZE;
+			int column_begin = chunk > visible_left ? chunk : visible_left;
+			int column_end = chunk + chunk_width < visible_right ? chunk + chunk_width : visible_right;
+			size_t offset = base + (size_t)band * sprite->width + (size_t)chunk * band_height + (size_t)(row_begin - band) * chunk_width + (column_begin - chunk);
+			for (int row = row_begin; row < row_end; row++, offset += chunk_width)
+			{
+				cell_t* dst = &frame[row + y][column_begin + x];
+				if (sprite->mask)
+				{
+					/* transparent cells leave whatever was drawn before showing through */
+					blit_interleave_masked(dst, sprite->text + offset, sprite->attrib + offset, sprite->mask, offset - base, column_end - column_begin);
+				}
+				else
+				{
+					blit_interleave(dst, sprite->text + offset, sprite->attrib + offset, column_end - column_begin);
+				}
+			}
+		}
+	}
+	profile_end(PROFILE_RENDER, start);
+}
+
+void screen_text_render(int x, int y, const char* text, attribute_t attrib)
+{
+	if (y < 0 || y >= TARGET_HEIGHT)
+	{
+		return;
+	}
+	for (; *text && x < TARGET_WIDTH; text++, x++)
+	{
+		if (x >= 0)
+		{
+			frame[y][x] = (cell_t){ (unsigned char)*text, attrib };
+		}
+	}
+}
+
+void screen_sprite_render_thumbnail(int x, int y, int width, int height, sprite_t sprite)
+{
+	RUNTIME_ASSERT(sprite);
+	if (sprite->width <= width && sprite->height <= height)
+	{
+		screen_sprite_render(x + (width - sprite->width) / 2, y + (height - sprite->height) / 2, sprite);
+		return;
+	}
+
+	/* the biggest level that fits, or the smallest there is */
+	int level_width = sprite->width, level_height = sprite->height;
+	size_t offset = 0;
+	for (int level = 0; level < sprite->mip_count; level++)
+	{
+		if (level > 0)
+		{
+			offset += (size_t)level_width * level_height;
+		}
+		level_width = (level_width + 1) / 2;
+		level_height = (level_height + 1) / 2;
+		if (level_width <= width && level_height <= height)
+		{
+			break;
+		}
+	}
+
+	int left = x + (width - level_width) / 2, top = y + (height - level_height) / 2;
+	int clip_left = x > 0 ? x : 0, clip_top = y > 0 ? y : 0;
+	int clip_right = x + width < TARGET_WIDTH ? x + width : TARGET_WIDTH;
+	int clip_bottom = y + height < TARGET_HEIGHT ? y + height : TARGET_HEIGHT;
+	int column_begin = left > clip_left ? left : clip_left;
+	int column_end = left + level_width < clip_right ? left + level_width : clip_right;
+	if (column_begin >= column_end)
+	{
+		return;
+	}
+	for (int row = top > clip_top ? top : clip_top; row < top + level_height && row < clip_bottom; row++)
+	{
+		size_t cell = offset + (size_t)(row - top) * level_width + (column_begin - left);
+		blit_interleave(&frame[row][column_begin], sprite->mip_text + cell, sprite->mip_attrib + cell, column_end - column_begin);
+	}
+}
+
+void screen_sprite_read_row(sprite_t sprite, int index, int y, char* text, attribute_t* attrib)
+{
+	RUNTIME_ASSERT(sprite && y >= 0 && y < sprite->height);
+	index = (index % sprite->frame_count + sprite->frame_count) % sprite->frame_count;
+	if (sprite->runs)
+	{
+		/* transparent cells aren't kept, they read as blanks */
+		memset(text, 0, sprite->width * sizeof * text);
+		memset(attrib, 0, sprite->width * sizeof * attrib);
+		int row = index * sprite->height + y;
+		for (const struct screen_run* run = sprite->runs + sprite->run_rows[row]; run < sprite->runs + sprite->run_rows[row + 1]; run++)
+		{
+			for (int i = run->x; i < run->x + run->length; i++)
+			{
+				text[i] = (char)run->ch;
+				attrib[i] = run->attrib;
+			}
+		}
+		return;
+	}
+	int band = y & ~(SCREEN_CHUNK_SIZE - 1);
+	int band_height = sprite->height - band < SCREEN_CHUNK_SIZE ? sprite->height - band : SCREEN_CHUNK_SIZE;
+	size_t base = (size_t)index * sprite->width * sprite->height + (size_t)band * sprite->width;
+	for (int chunk = 0; chunk < sprite->width; chunk += SCREEN_CHUNK_SIZE)
+	{
+		int chunk_width = sprite->width - chunk < SCREEN_CHUNK_SIZE ? sprite->width - chunk : SCREEN_CHUNK_SIZE;
+		size_t offset = base + (size_t)chunk * band_height + (size_t)(y - band) * chunk_width;
+		memcpy(text + chunk, sprite->text + offset, chunk_width * sizeof * text);
+		memcpy(attrib + chunk, sprite->attrib + offset, chunk_width * sizeof * attrib);
+	}
 }
 
 int screen_sprite_width(sprite_t sprite)
@@ -226,4 +952,69 @@ int screen_sprite_height(sprite_t sprite)
 {
 	RUNTIME_ASSERT(sprite);
 	return sprite->height;
+}
+
+int screen_sprite_frame_count(sprite_t sprite)
+{
+	RUNTIME_ASSERT(sprite);
+	return sprite->frame_count;
+}
+
+int screen_sprite_palette(sprite_t sprite)
+{
+	RUNTIME_ASSERT(sprite);
+	return sprite->palette;
+}
+
+const uint8_t* screen_sprite_transparency(sprite_t sprite)
+{
+	RUNTIME_ASSERT(sprite);
+	return sprite->transparency;
+}
+
+const uint8_t* screen_sprite_tile_type(sprite_t sprite)
+{
+	RUNTIME_ASSERT(sprite);
+	return sprite->tile_type;
+}
+
+size_t screen_sprite_size(sprite_t sprite)
+{
+	RUNTIME_ASSERT(sprite);
+	return sprite->size;
+}
+
+const char* screen_sprite_text(sprite_t sprite)
+{
+	RUNTIME_ASSERT(sprite);
+	return sprite->text;
+}
+
+const attribute_t* screen_sprite_attrib(sprite_t sprite)
+{
+	RUNTIME_ASSERT(sprite);
+	return sprite->attrib;
+}
+
+const void* screen_sprite_runs(sprite_t sprite)
+{
+	RUNTIME_ASSERT(sprite);
+	return sprite->run_rows;
+}
+
+int screen_sprite_stored_planes(sprite_t sprite, const void* planes[SCREEN_STORED_PLANES_MAX])
+{
+	RUNTIME_ASSERT(sprite);
+	if (!sprite->is_stored)
+	{
+		return 0;
+	}
+	if (sprite->run_rows)
+	{
+		planes[0] = sprite->run_rows;
+		return 1;
+	}
+	planes[0] = sprite->text;
+	planes[1] = sprite->attrib;
+	return 2;
 }
\ No newline at end of file
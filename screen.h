@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include "arena.h"
 #include "types.h"
 
 typedef int virtual_key_t;
@@ -113,24 +114,133 @@ typedef int virtual_key_t;
 
 typedef void (*screen_handle_repaint_t)();
 typedef void (*screen_handle_key_t)(virtual_key_t);
+typedef void (*screen_handle_wake_t)();
+typedef void (*screen_handle_input_drained_t)();
 
 typedef struct screen_events
 {
 	screen_handle_repaint_t repaint;
 	screen_handle_key_t keyboard;
+	/* optional, called on the loop's thread after screen_wake */
+	screen_handle_wake_t wake;
+	/* optional, called once every key that was already waiting has gone to keyboard, so held keys can be handled as one */
+	screen_handle_input_drained_t input_drained;
 } screen_events_t;
 
 void screen_initialize(screen_events_t events);
 void screen_destroy(void);
 void screen_loop(void);
 void screen_repaint(void);
+/* Safe from any thread, makes the loop call the wake event */
+void screen_wake(void);
+
+/* The palette screen_initialize starts with, and the one used for sprites that don't pick one */
+#define SCREEN_DEFAULT_PALETTE 1
 
 void screen_change_title(const char* title);
+/* Does nothing if id is already the palette in use */
 void screen_change_color_palette(int id);
+/*
+	Replaces the built in palettes with the ones in a text file, one per line in id order, each 16 colors
+	written as RRGGBB hex and indexed by color_t. Blank lines and lines starting with '#' are skipped.
+	Returns false and keeps the old palettes if the file can't be read or a line isn't 16 colors.
+*/
+bool screen_load_palettes(const char* path);
+int screen_palette_count(void);
+/* The 16 colors of a palette as 0xRRGGBB indexed by color_t, or NULL if there's no such palette */
+const uint32_t* screen_palette(int id);
+
+/*
+	Everything a sprite file describes. Image and Color repeat once per frame, so text and attrib
+	hold frame_count planes of width * height back to back. The optional planes are NULL when absent.
+*/
+typedef struct sprite_data
+{
+	int width, height;
+	int frame_count;
+	/* -1 when the sprite doesn't pick a palette */
+	int palette;
+	const char* text;
+	const attribute_t* attrib;
+	const uint8_t* transparency;
+	const uint8_t* tile_type;
+} sprite_data_t;
+
+/* Every plane a built sprite keeps, in their final layout */
+typedef enum sprite_plane
+{
+	SPRITE_PLANE_ATTRIB,
+	SPRITE_PLANE_TEXT,
+	/* the row offsets followed by the runs, in place of attrib and text for run-length encoded sprites */
+	SPRITE_PLANE_RUNS,
+	SPRITE_PLANE_MIP_ATTRIB,
+	SPRITE_PLANE_MIP_TEXT,
+	SPRITE_PLANE_TRANSPARENCY,
+	SPRITE_PLANE_TILE_TYPE,
+	SPRITE_PLANE_MASK,
+	SPRITE_PLANE_COUNT
+} sprite_plane_t;
+
+/*
+	A built sprite as flat planes, which the compiled cache writes out and loads back without redoing
+	chunks, runs, mips or the mask. Planes the sprite doesn't have are NULL with a size of 0.
+*/
+typedef struct sprite_image
+{
+	int width, height;
+	int frame_count;
+	int palette;
+	const void* planes[SPRITE_PLANE_COUNT];
+	size_t sizes[SPRITE_PLANE_COUNT];
+} sprite_image_t;
 
 sprite_t screen_sprite_create(int width, int height, char* text, attribute_t* attrib);
+/*
+	Copies every frame and plane into one allocation taken from arena. Without an arena the frames go
+	to the plane store instead, shared with any sprite that has identical Image or Color data.
+*/
+sprite_t screen_sprite_create_frames(const sprite_data_t* data, arena_t arena);
+/*
+	Copies an image back into a sprite, with the same arena and plane store rules as screen_sprite_create_frames.
+	The planes have to be aligned like they were in the sprite. Returns NULL if they don't match its size, like from a damaged file.
+*/
+sprite_t screen_sprite_create_image(const sprite_image_t* image, arena_t arena);
+/* Points image at the sprite's own planes, they're valid for as long as the sprite is */
+void screen_sprite_image(sprite_t sprite, sprite_image_t* image);
+/* Does nothing for sprites that live in an arena, they go when it's destroyed */
 void screen_sprite_destroy(sprite_t sprite);
+/* Composites into the frame being built, only valid inside the repaint event. The frame is shown once the event returns. */
 void screen_sprite_render(int x, int y, sprite_t sprite);
+/* Same as screen_sprite_render for the given frame, which wraps around the sprite's frame count */
+void screen_sprite_render_frame(int x, int y, sprite_t sprite, int frame);
+/* Draws a line of text, clipped to the screen. Only valid inside the repaint event, like the sprite renders. */
+void screen_text_render(int x, int y, const char* text, attribute_t attrib);
+/*
+	Draws the first frame centered in a width by height box, using the biggest precomputed mip level
+	that fits when the sprite doesn't. Mip levels are drawn opaque and clipped to the box.
+*/
+void screen_sprite_render_thumbnail(int x, int y, int width, int height, sprite_t sprite);
+
+/* Copies row y of a frame out of the sprite's chunks into width cells of text and attrib */
+void screen_sprite_read_row(sprite_t sprite, int frame, int y, char* text, attribute_t* attrib);
 
 int screen_sprite_width(sprite_t sprite);
-int screen_sprite_height(sprite_t sprite);
\ No newline at end of file
+int screen_sprite_height(sprite_t sprite);
+int screen_sprite_frame_count(sprite_t sprite);
+int screen_sprite_palette(sprite_t sprite);
+/* Width * height planes shared by every frame, NULL when the file didn't have them */
+const uint8_t* screen_sprite_transparency(sprite_t sprite);
+const uint8_t* screen_sprite_tile_type(sprite_t sprite);
+/* Bytes the sprite holds by itself including its header, not counting its frames in the plane store */
+size_t screen_sprite_size(sprite_t sprite);
+/* Most planes a sprite keeps in the plane store, its Image and Color frames or its runs */
+#define SCREEN_STORED_PLANES_MAX 2
+/* Writes the sprite's frames in the plane store to planes, with store_size giving their bytes. Returns how many, 0 for arena sprites. */
+int screen_sprite_stored_planes(sprite_t sprite, const void* planes[SCREEN_STORED_PLANES_MAX]);
+/*
+	The frames in chunk order, or NULL for a sprite that was run-length encoded, which has screen_sprite_runs instead.
+	Sprites from the plane store with identical planes return the same pointer.
+*/
+const char* screen_sprite_text(sprite_t sprite);
+const attribute_t* screen_sprite_attrib(sprite_t sprite);
+const void* screen_sprite_runs(sprite_t sprite);
\ No newline at end of file
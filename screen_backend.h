@@ -0,0 +1,44 @@
+/*
+	screen_backend.h ~ RL
+
+	Internal to the screen module. screen.c owns the frame and sprites, and hands finished
+	frames to exactly one backend (screen_win32.c or screen_posix.c) for presentation and input.
+*/
+
+#pragma once
+
+#include "screen.h"
+#include "types.h"
+#include <stdlib.h>
+
+#define RUNTIME_ASSERT(cond) if (!(cond)) exit(-1);
+
+/* Same layout as a Win32 CHAR_INFO, so the console backend can hand the frame over as is */
+typedef struct cell
+{
+	uint16_t ch;
+	attribute_t attrib;
+} cell_t;
+
+/* right and bottom are exclusive */
+typedef struct screen_region
+{
+	int left, top, right, bottom;
+} screen_region_t;
+
+extern screen_events_t screen_events;
+
+/* Forces the next repaint to send the whole frame, for when the backend lost what it showed */
+void screen_invalidate(void);
+
+void screen_backend_initialize(void);
+void screen_backend_destroy(void);
+void screen_backend_loop(void);
+/* Called from any thread, the loop then calls screen_events.wake on its own thread */
+void screen_backend_wake(void);
+void screen_backend_change_title(const char* title);
+/* Every palette there is, colors are 0xRRGGBB indexed by color_t. Called again whenever they're reloaded. */
+void screen_backend_set_palettes(const uint32_t (*palettes)[16], int count);
+/* Switches to one of the palettes, which recolors everything already on screen */
+void screen_backend_change_palette(int id);
+void screen_backend_present(const cell_t frame[TARGET_HEIGHT][TARGET_WIDTH], const screen_region_t* regions, int count);
\ No newline at end of file
@@ -0,0 +1,514 @@
+/*
+	screen_posix.c ~ RL
+
+	ANSI terminal backend for the screen module, for running over SSH and on Linux.
+	Every frame is built into one escape sequence buffer and sent with a single write().
+*/
+
+#ifndef _WIN32
+
+#include "screen_backend.h"
+
+#include "log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define ESC "\x1B"
+/* how long a lone escape byte waits for the rest of a sequence before it's the escape key */
+#define SCREEN_ESCAPE_TIMEOUT_MS 25
+/* room for the longest SGR sequence, ESC[38;2;255;255;255;48;2;255;255;255m */
+#define SCREEN_SGR_SIZE 40
+/* worst case per cell is a full SGR sequence plus a four byte glyph copy, and a cursor move per row */
+#define SCREEN_OUTPUT_SIZE (TARGET_WIDTH * TARGET_HEIGHT * (SCREEN_SGR_SIZE + 4) + TARGET_HEIGHT * 16 + 64)
+
+/* Dig-N-Rig's font follows code page 437, these are the closest Unicode glyphs in UTF-8 */
+static const struct glyph
+{
+	char bytes[4];
+	int length;
+} glyphs[256] =
+{
+	{ " ", 1 }, { "\xE2\x98\xBA", 3 }, { "\xE2\x98\xBB", 3 }, { "\xE2\x99\xA5", 3 }, { "\xE2\x99\xA6", 3 }, { "\xE2\x99\xA3", 3 }, { "\xE2\x99\xA0", 3 }, { "\xE2\x80\xA2", 3 },
+	{ "\xE2\x97\x98", 3 }, { "\xE2\x97\x8B", 3 }, { "\xE2\x97\x99", 3 }, { "\xE2\x99\x82", 3 }, { "\xE2\x99\x80", 3 }, { "\xE2\x99\xAA", 3 }, { "\xE2\x99\xAB", 3 }, { "\xE2\x98\xBC", 3 },
+	{ "\xE2\x96\xBA", 3 }, { "\xE2\x97\x84", 3 }, { "\xE2\x86\x95", 3 }, { "\xE2\x80\xBC", 3 }, { "\xC2\xB6", 2 }, { "\xC2\xA7", 2 }, { "\xE2\x96\xAC", 3 }, { "\xE2\x86\xA8", 3 },
+	{ "\xE2\x86\x91", 3 }, { "\xE2\x86\x93", 3 }, { "\xE2\x86\x92", 3 }, { "\xE2\x86\x90", 3 }, { "\xE2\x88\x9F", 3 }, { "\xE2\x86\x94", 3 }, { "\xE2\x96\xB2", 3 }, { "\xE2\x96\xBC", 3 },
+	{ " ", 1 }, { "!", 1 }, { "\"", 1 }, { "#", 1 }, { "$", 1 }, { "%", 1 }, { "&", 1 }, { "'", 1 },
+	{ "(", 1 }, { ")", 1 }, { "*", 1 }, { "+", 1 }, { ",", 1 }, { "-", 1 }, { ".", 1 }, { "/", 1 },
+	{ "0", 1 }, { "1", 1 }, { "2", 1 }, { "3", 1 }, { "4", 1 }, { "5", 1 }, { "6", 1 }, { "7", 1 },
+	{ "8", 1 }, { "9", 1 }, { ":", 1 }, { ";", 1 }, { "<", 1 }, { "=", 1 }, { ">", 1 }, { "?", 1 },
+	{ "@", 1 }, { "A", 1 }, { "B", 1 }, { "C", 1 }, { "D", 1 }, { "E", 1 }, { "F", 1 }, { "G", 1 },
+	{ "H", 1 }, { "I", 1 }, { "J", 1 }, { "K", 1 }, { "L", 1 }, { "M", 1 }, { "N", 1 }, { "O", 1 },
+	{ "P", 1 }, { "Q", 1 }, { "R", 1 }, { "S", 1 }, { "T", 1 }, { "U", 1 }, { "V", 1 }, { "W", 1 },
+	{ "X", 1 }, { "Y", 1 }, { "Z", 1 }, { "[", 1 }, { "\\", 1 }, { "]", 1 }, { "^", 1 }, { "_", 1 },
+	{ "`", 1 }, { "a", 1 }, { "b", 1 }, { "c", 1 }, { "d", 1 }, { "e", 1 }, { "f", 1 }, { "g", 1 },
+	{ "h", 1 }, { "i", 1 }, { "j", 1 }, { "k", 1 }, { "l", 1 }, { "m", 1 }, { "n", 1 }, { "o", 1 },
+	{ "p", 1 }, { "q", 1 }, { "r", 1 }, { "s", 1 }, { "t", 1 }, { "u", 1 }, { "v", 1 }, { "w", 1 },
+	{ "x", 1 }, { "y", 1 }, { "z", 1 }, { "{", 1 }, { "|", 1 }, { "}", 1 }, { "~", 1 }, { "\xE2\x8C\x82", 3 },
+	{ "\xC3\x87", 2 }, { "\xC3\xBC", 2 }, { "\xC3\xA9", 2 }, { "\xC3\xA2", 2 }, { "\xC3\xA4", 2 }, { "\xC3\xA0", 2 }, { "\xC3\xA5", 2 }, { "\xC3\xA7", 2 },
+	{ "\xC3\xAA", 2 }, { "\xC3\xAB", 2 }, { "\xC3\xA8", 2 }, { "\xC3\xAF", 2 }, { "\xC3\xAE", 2 }, { "\xC3\xAC", 2 }, { "\xC3\x84", 2 }, { "\xC3\x85", 2 },
+	{ "\xC3\x89", 2 }, { "\xC3\xA6", 2 }, { "\xC3\x86", 2 }, { "\xC3\xB4", 2 }, { "\xC3\xB6", 2 }, { "\xC3\xB2", 2 }, { "\xC3\xBB", 2 }, { "\xC3\xB9", 2 },
+	{ "\xC3\xBF", 2 }, { "\xC3\x96", 2 }, { "\xC3\x9C", 2 }, { "\xC2\xA2", 2 }, { "\xC2\xA3", 2 }, { "\xC2\xA5", 2 }, { "\xE2\x82\xA7", 3 }, { "\xC6\x92", 2 },
+	{ "\xC3\xA1", 2 }, { "\xC3\xAD", 2 }, { "\xC3\xB3", 2 }, { "\xC3\xBA", 2 }, { "\xC3\xB1", 2 }, { "\xC3\x91", 2 }, { "\xC2\xAA", 2 }, { "\xC2\xBA", 2 },
+	{ "\xC2\xBF", 2 }, { "\xE2\x8C\x90", 3 }, { "\xC2\xAC", 2 }, { "\xC2\xBD", 2 }, { "\xC2\xBC", 2 }, { "\xC2\xA1", 2 }, { "\xC2\xAB", 2 }, { "\xC2\xBB", 2 },
+	{ "\xE2\x96\x91", 3 }, { "\xE2\x96\x92", 3 }, { "\xE2\x96\x93", 3 }, { "\xE2\x94\x82", 3 }, { "\xE2\x94\xA4", 3 }, { "\xE2\x95\xA1", 3 }, { "\xE2\x95\xA2", 3 }, { "\xE2\x95\x96", 3 },
+	{ "\xE2\x95\x95", 3 }, { "\xE2\x95\xA3", 3 }, { "\xE2\x95\x91", 3 }, { "\xE2\x95\x97", 3 }, { "\xE2\x95\x9D", 3 }, { "\xE2\x95\x9C", 3 }, { "\xE2\x95\x9B", 3 }, { "\xE2\x94\x90", 3 },
+	{ "\xE2\x94\x94", 3 }, { "\xE2\x94\xB4", 3 }, { "\xE2\x94\xAC", 3 }, { "\xE2\x94\x9C", 3 }, { "\xE2\x94\x80", 3 }, { "\xE2\x94\xBC", 3 }, { "\xE2\x95\x9E", 3 }, { "\xE2\x95\x9F", 3 },
+	{ "\xE2\x95\x9A", 3 }, { "\xE2\x95\x94", 3 }, { "\xE2\x95\xA9", 3 }, { "\xE2\x95\xA6", 3 }, { "\xE2\x95\xA0", 3 }, { "\xE2\x95\x90", 3 }, { "\xE2\x95\xAC", 3 }, { "\xE2\x95\xA7", 3 },
+	{ "\xE2\x95\xA8", 3 }, { "\xE2\x95\xA4", 3 }, { "\xE2\x95\xA5", 3 }, { "\xE2\x95\x99", 3 }, { "\xE2\x95\x98", 3 }, { "\xE2\x95\x92", 3 }, { "\xE2\x95\x93", 3 }, { "\xE2\x95\xAB", 3 },
+	{ "\xE2\x95\xAA", 3 }, { "\xE2\x94\x98", 3 }, { "\xE2\x94\x8C", 3 }, { "\xE2\x96\x88", 3 }, { "\xE2\x96\x84", 3 }, { "\xE2\x96\x8C", 3 }, { "\xE2\x96\x90", 3 }, { "\xE2\x96\x80", 3 },
+	{ "\xCE\xB1", 2 }, { "\xC3\x9F", 2 }, { "\xCE\x93", 2 }, { "\xCF\x80", 2 }, { "\xCE\xA3", 2 }, { "\xCF\x83", 2 }, { "\xC2\xB5", 2 }, { "\xCF\x84", 2 },
+	{ "\xCE\xA6", 2 }, { "\xCE\x98", 2 }, { "\xCE\xA9", 2 }, { "\xCE\xB4", 2 }, { "\xE2\x88\x9E", 3 }, { "\xCF\x86", 2 }, { "\xCE\xB5", 2 }, { "\xE2\x88\xA9", 3 },
+	{ "\xE2\x89\xA1", 3 }, { "\xC2\xB1", 2 }, { "\xE2\x89\xA5", 3 }, { "\xE2\x89\xA4", 3 }, { "\xE2\x8C\xA0", 3 }, { "\xE2\x8C\xA1", 3 }, { "\xC3\xB7", 2 }, { "\xE2\x89\x88", 3 },
+	{ "\xC2\xB0", 2 }, { "\xE2\x88\x99", 3 }, { "\xC2\xB7", 2 }, { "\xE2\x88\x9A", 3 }, { "\xE2\x81\xBF", 3 }, { "\xC2\xB2", 2 }, { "\xE2\x96\xA0", 3 }, { "\xC2\xA0", 2 }
+};
+
+/* console colors are 0bIRGB, ANSI colors are 0bBGR */
+static const int ansi_order[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+
+/* The escape sequence that switches to an attribute byte's colors, ready to copy into the output */
+struct screen_sgr
+{
+	char bytes[SCREEN_SGR_SIZE];
+	int length;
+};
+
+/*
+	A table per palette, built when the palettes are set, so drawing a cell is a copy and switching
+	palettes only changes sgr. Terminals with 24-bit color get each palette's exact RGB values, the
+	rest share one table of the 16 ANSI colors and have those redefined by the palette instead.
+*/
+static bool is_truecolor;
+static struct screen_sgr indexed_sgr[256];
+static struct screen_sgr (*truecolor_sgr)[256];
+static const struct screen_sgr* sgr = indexed_sgr;
+static const uint32_t (*palettes)[16];
+
+static struct termios original_termios;
+static bool is_initialized;
+static volatile sig_atomic_t was_resized;
+/* self-pipe, screen_backend_wake writes a byte to end the loop's poll */
+static int wake_pipe[2] = { -1, -1 };
+static int terminal_width = TARGET_WIDTH, terminal_height = TARGET_HEIGHT;
+static char output[SCREEN_OUTPUT_SIZE];
+
+static void screen_write_all(const char* buf, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t written = write(STDOUT_FILENO, buf, size);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return;
+		}
+		buf += written;
+		size -= written;
+	}
+}
+
+static void screen_write_string(const char* str)
+{
+	screen_write_all(str, strlen(str));
+}
+
+static inline char* screen_append_int(char* p, int value)
+{
+	char digits[12];
+	int count = 0;
+	do
+	{
+		digits[count++] = '0' + value % 10;
+		value /= 10;
+	} while (value > 0);
+	while (count > 0)
+	{
+		*p++ = digits[--count];
+	}
+	return p;
+}
+
+static void screen_query_size(void)
+{
+	struct winsize ws;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 && ws.ws_row > 0)
+	{
+		terminal_width = ws.ws_col;
+		terminal_height = ws.ws_row;
+	}
+}
+
+static void screen_handle_resize(int signal)
+{
+	(void)signal;
+	was_resized = 1;
+}
+
+static void screen_restore(void)
+{
+	if (!is_initialized)
+	{
+		return;
+	}
+	is_initialized = false;
+	/* reset attributes and palette, show the cursor and leave the alternate screen */
+	screen_write_string(ESC "[0m" ESC "]104" ESC "\\" ESC "[?25h" ESC "[?1049l");
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &original_termios);
+	/* the terminal is back to normal, so whatever was logged meanwhile can be shown */
+	log_hold(false);
+}
+
+void screen_backend_initialize(void)
+{
+	RUNTIME_ASSERT(isatty(STDIN_FILENO) && isatty(STDOUT_FILENO));
+	const char* colorterm = getenv("COLORTERM");
+	is_truecolor = colorterm && (strcmp(colorterm, "truecolor") == 0 || strcmp(colorterm, "24bit") == 0);
+	RUNTIME_ASSERT(tcgetattr(STDIN_FILENO, &original_termios) == 0);
+
+	struct termios raw = original_termios;
+	raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+	raw.c_oflag &= ~OPOST;
+	raw.c_cflag |= CS8;
+	raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	RUNTIME_ASSERT(tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == 0);
+
+	/* stderr is usually this terminal, messages wait until the screen is gone. Before atexit, so logging stops after screen_restore. */
+	log_hold(isatty(STDERR_FILENO));
+	is_initialized = true;
+	atexit(screen_restore);
+
+	/* no SA_RESTART, so a resize interrupts the poll in the input loop */
+	struct sigaction sa = { .sa_handler = screen_handle_resize };
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGWINCH, &sa, NULL);
+	screen_query_size();
+
+	RUNTIME_ASSERT(pipe(wake_pipe) == 0);
+	fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+
+	/* alternate screen, hidden cursor, cleared */
+	screen_write_string(ESC "[?1049h" ESC "[?25l" ESC "[0m" ESC "[2J");
+}
+
+void screen_backend_destroy(void)
+{
+	screen_restore();
+	free(truecolor_sgr);
+	truecolor_sgr = NULL;
+	sgr = indexed_sgr;
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+	wake_pipe[0] = wake_pipe[1] = -1;
+}
+
+void screen_backend_wake(void)
+{
+	/* a full pipe already has a wake pending */
+	char ch = 0;
+	if (write(wake_pipe[1], &ch, 1) < 0 && errno != EAGAIN)
+	{
+		log_error("Failed to wake the screen loop\n");
+	}
+}
+
+/* Waits up to timeout milliseconds for a byte, returns -1 if none arrived */
+static int screen_read_byte(int timeout)
+{
+	struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+	if (poll(&pfd, 1, timeout) <= 0)
+	{
+		return -1;
+	}
+	unsigned char ch;
+	return read(STDIN_FILENO, &ch, 1) == 1 ? ch : -1;
+}
+
+/* Decodes the rest of a sequence after ESC into a virtual key, 0 if it isn't one we know */
+static virtual_key_t screen_decode_escape(void)
+{
+	int ch = screen_read_byte(SCREEN_ESCAPE_TIMEOUT_MS);
+	if (ch < 0)
+	{
+		return VK_ESCAPE;
+	}
+	if (ch == 'O')
+	{
+		/* SS3, used for F1-F4 and by some terminals for arrows */
+		switch (screen_read_byte(SCREEN_ESCAPE_TIMEOUT_MS))
+		{
+		case 'A': return VK_UP;
+		case 'B': return VK_DOWN;
+		case 'C': return VK_RIGHT;
+		case 'D': return VK_LEFT;
+		case 'H': return VK_HOME;
+		case 'F': return VK_END;
+		case 'P': return VK_F1;
+		case 'Q': return VK_F2;
+		case 'R': return VK_F3;
+		case 'S': return VK_F4;
+		}
+		return 0;
+	}
+	if (ch != '[')
+	{
+		return 0;
+	}
+
+	/* CSI: parameters then a final byte */
+	int param = 0;
+	while ((ch = screen_read_byte(SCREEN_ESCAPE_TIMEOUT_MS)) >= 0)
+	{
+		if (ch >= '0' && ch <= '9')
+		{
+			param = param * 10 + ch - '0';
+		}
+		else if (ch != ';')
+		{
+			break;
+		}
+	}
+	switch (ch)
+	{
+	case 'A': return VK_UP;
+	case 'B': return VK_DOWN;
+	case 'C': return VK_RIGHT;
+	case 'D': return VK_LEFT;
+	case 'H': return VK_HOME;
+	case 'F': return VK_END;
+	case '~':
+		switch (param)
+		{
+		case 1: case 7: return VK_HOME;
+		case 2: return VK_INSERT;
+		case 3: return VK_DELETE;
+		case 4: case 8: return VK_END;
+		case 5: return VK_PRIOR;
+		case 6: return VK_NEXT;
+		case 15: return VK_F5;
+		case 17: return VK_F6;
+		case 18: return VK_F7;
+		case 19: return VK_F8;
+		case 20: return VK_F9;
+		case 21: return VK_F10;
+		case 23: return VK_F11;
+		case 24: return VK_F12;
+		}
+	}
+	return 0;
+}
+
+static virtual_key_t screen_decode_key(int ch)
+{
+	if (ch == 0x1B)
+	{
+		return screen_decode_escape();
+	}
+	if (ch >= 'a' && ch <= 'z')
+	{
+		return ch - 'a' + 'A';
+	}
+	if ((ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == ' ')
+	{
+		return ch;
+	}
+	switch (ch)
+	{
+	case '\r': case '\n': return VK_RETURN;
+	case '\t': return VK_TAB;
+	case 0x7F: case 0x08: return VK_BACK;
+	}
+	return 0;
+}
+
+void screen_backend_loop(void)
+{
+	for (;;)
+	{
+		if (was_resized)
+		{
+			was_resized = 0;
+			screen_query_size();
+			screen_write_string(ESC "[0m" ESC "[2J");
+			screen_invalidate();
+			screen_repaint();
+		}
+
+		struct pollfd pfds[2] = { { .fd = STDIN_FILENO, .events = POLLIN }, { .fd = wake_pipe[0], .events = POLLIN } };
+		int ready = poll(pfds, 2, -1);
+		if (ready < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (ready <= 0)
+		{
+			return;
+		}
+		if (pfds[1].revents & POLLIN)
+		{
+			/* any number of wakes collapse into one event */
+			char drain[64];
+			while (read(wake_pipe[0], drain, sizeof drain) > 0);
+			if (screen_events.wake)
+			{
+				screen_events.wake();
+			}
+		}
+		if (!(pfds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+		{
+			continue;
+		}
+
+		/* every key already buffered is handled before input_drained, so a held key's repeats arrive together */
+		int ch = screen_read_byte(0);
+		if (ch < 0)
+		{
+			/* readable with nothing to read is the end of input */
+			return;
+		}
+		do
+		{
+			virtual_key_t vk = screen_decode_key(ch);
+			if (vk == VK_ESCAPE)
+			{
+				return;
+			}
+			if (vk)
+			{
+				screen_events.keyboard(vk);
+			}
+		} while ((ch = screen_read_byte(0)) >= 0);
+		if (screen_events.input_drained)
+		{
+			screen_events.input_drained();
+		}
+	}
+}
+
+void screen_backend_change_title(const char* title)
+{
+	/* the title is cut short rather than the sequence, a missing BEL would swallow everything after it */
+	char buf[512];
+	int max_title = (int)sizeof buf - (int)sizeof(ESC "]0;\x07");
+	int len = snprintf(buf, sizeof buf, ESC "]0;%.*s\x07", max_title, title);
+	if (len > 0)
+	{
+		screen_write_all(buf, len);
+	}
+}
+
+/* Low nibble of an attribute is the foreground, high nibble the background */
+static void screen_build_indexed_sgr(struct screen_sgr* out, int attrib)
+{
+	int fg = attrib & 0xF, bg = attrib >> 4 & 0xF;
+	char* p = out->bytes;
+	memcpy(p, ESC "[", 2);
+	p = screen_append_int(p + 2, (fg & 8 ? 90 : 30) + ansi_order[fg & 7]);
+	*p++ = ';';
+	p = screen_append_int(p, (bg & 8 ? 100 : 40) + ansi_order[bg & 7]);
+	*p++ = 'm';
+	out->length = (int)(p - out->bytes);
+}
+
+static void screen_build_truecolor_sgr(struct screen_sgr* out, int attrib, const uint32_t colors[16])
+{
+	uint32_t fg = colors[attrib & 0xF], bg = colors[attrib >> 4 & 0xF];
+	out->length = snprintf(out->bytes, sizeof out->bytes, ESC "[38;2;%u;%u;%u;48;2;%u;%u;%um",
+		fg >> 16 & 0xFF, fg >> 8 & 0xFF, fg & 0xFF, bg >> 16 & 0xFF, bg >> 8 & 0xFF, bg & 0xFF);
+}
+
+void screen_backend_set_palettes(const uint32_t (*colors)[16], int count)
+{
+	palettes = colors;
+	for (int attrib = 0; attrib < 256; attrib++)
+	{
+		screen_build_indexed_sgr(&indexed_sgr[attrib], attrib);
+	}
+	if (!is_truecolor)
+	{
+		return;
+	}
+	free(truecolor_sgr);
+	truecolor_sgr = dig_malloc(count * sizeof * truecolor_sgr);
+	for (int id = 0; id < count; id++)
+	{
+		for (int attrib = 0; attrib < 256; attrib++)
+		{
+			screen_build_truecolor_sgr(&truecolor_sgr[id][attrib], attrib, colors[id]);
+		}
+	}
+	/* the old tables are gone, screen_backend_change_palette is called next */
+	sgr = indexed_sgr;
+}
+
+void screen_backend_change_palette(int id)
+{
+	/* the colors are in every cell that was sent, so all of them are sent again */
+	screen_invalidate();
+	if (is_truecolor)
+	{
+		sgr = truecolor_sgr[id];
+		return;
+	}
+
+	/* xterm style OSC 4, the 16 ANSI colors are redefined to the requested palette */
+	const uint32_t* colors = palettes[id];
+	char buf[16 * 32];
+	char* p = buf;
+	for (int i = 0; i < 16; i++)
+	{
+		int ansi = ansi_order[i & 7] + (i & 8);
+		p += sprintf(p, ESC "]4;%i;rgb:%02x/%02x/%02x" ESC "\\", ansi, colors[i] >> 16 & 0xFF, colors[i] >> 8 & 0xFF, colors[i] & 0xFF);
+	}
+	screen_write_all(buf, p - buf);
+}
+
+void screen_backend_present(const cell_t frame[TARGET_HEIGHT][TARGET_WIDTH], const screen_region_t* regions, int count)
+{
+	char* p = output;
+	int last_attrib = -1;
+	for (int i = 0; i < count; i++)
+	{
+		int right = regions[i].right < terminal_width ? regions[i].right : terminal_width;
+		int bottom = regions[i].bottom < terminal_height ? regions[i].bottom : terminal_height;
+		for (int y = regions[i].top; y < bottom && regions[i].left < right; y++)
+		{
+			/* cursor positions are one based */
+			memcpy(p, ESC "[", 2);
+			p = screen_append_int(p + 2, y + 1);
+			*p++ = ';';
+			p = screen_append_int(p, regions[i].left + 1);
+			*p++ = 'H';
+
+			for (int x = regions[i].left; x < right; x++)
+			{
+				const cell_t* cell = &frame[y][x];
+				if (cell->attrib != last_attrib)
+				{
+					/* copied whole, the output has room for a full sequence per cell */
+					const struct screen_sgr* sequence = &sgr[cell->attrib & 0xFF];
+					memcpy(p, sequence->bytes, SCREEN_SGR_SIZE);
+					p += sequence->length;
+					last_attrib = cell->attrib;
+				}
+				const struct glyph* glyph = &glyphs[cell->ch & 0xFF];
+				memcpy(p, glyph->bytes, 4);
+				p += glyph->length;
+			}
+		}
+	}
+	screen_write_all(output, p - output);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,206 @@
+/*
+	screen_win32.c ~ RL
+
+	Win32 console backend for the screen module.
+*/
+
+#ifdef _WIN32
+
+#include "screen_backend.h"
+
+#include "log.h"
+#include <stdio.h>
+#include <string.h>
+#include <Windows.h>
+
+#define SCREEN_FONT L"digfont9"
+/* menu events are never sent to console programs on their own, so one with this id can only be a wake */
+#define SCREEN_WAKE_COMMAND 0xD16
+/* input records read per call */
+#define SCREEN_INPUT_BATCH 64
+
+static HANDLE in, out;
+static uint32_t palette[16];
+static const uint32_t (*palettes)[16];
+
+static void screen_apply_palette(void)
+{
+	CONSOLE_SCREEN_BUFFER_INFOEX csbi = { .cbSize = sizeof csbi };
+	RUNTIME_ASSERT(GetConsoleScreenBufferInfoEx(out, &csbi));
+	for (int i = 0; i < 16; i++)
+	{
+		csbi.ColorTable[i] = RGB(palette[i] >> 16 & 0xFF, palette[i] >> 8 & 0xFF, palette[i] & 0xFF);
+	}
+	RUNTIME_ASSERT(SetConsoleScreenBufferInfoEx(out, &csbi));
+}
+
+static void screen_initialize_output()
+{
+	CONSOLE_SCREEN_BUFFER_INFOEX csbi = { .cbSize = sizeof csbi };
+	RUNTIME_ASSERT(GetConsoleScreenBufferInfoEx(out, &csbi));
+
+	csbi.dwMaximumWindowSize.X = TARGET_WIDTH;
+	csbi.dwMaximumWindowSize.Y = TARGET_HEIGHT;
+	csbi.dwSize = csbi.dwMaximumWindowSize;
+
+	csbi.srWindow.Left = 0;
+	csbi.srWindow.Top = 0;
+	csbi.srWindow.Right = csbi.dwSize.X - 1;
+	csbi.srWindow.Bottom = csbi.dwSize.Y - 1;
+
+	RUNTIME_ASSERT(SetConsoleScreenBufferInfoEx(out, &csbi));
+
+	screen_apply_palette();
+	screen_invalidate();
+}
+
+static void screen_initialize_cursor(void)
+{
+	CONSOLE_CURSOR_INFO cci;
+	RUNTIME_ASSERT(GetConsoleCursorInfo(out, &cci));
+	cci.bVisible = FALSE;
+	RUNTIME_ASSERT(SetConsoleCursorInfo(out, &cci));
+}
+
+void screen_backend_initialize(void)
+{
+	in = GetStdHandle(STD_INPUT_HANDLE);
+	RUNTIME_ASSERT(in != INVALID_HANDLE_VALUE && in);
+
+	out = CreateConsoleScreenBuffer(GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, CONSOLE_TEXTMODE_BUFFER, NULL);
+	RUNTIME_ASSERT(out != INVALID_HANDLE_VALUE);
+
+	screen_initialize_output();
+
+	CONSOLE_FONT_INFOEX cfi = { .cbSize = sizeof cfi };
+	RUNTIME_ASSERT(GetCurrentConsoleFontEx(out, FALSE, &cfi));
+
+	cfi.dwFontSize = (COORD){ TARGET_CELL_SIZE - 1, TARGET_CELL_SIZE };
+	cfi.FontFamily = FF_DONTCARE;
+	cfi.nFont = 0;
+	swprintf(cfi.FaceName, sizeof cfi.FaceName / sizeof * cfi.FaceName, SCREEN_FONT);
+
+	RUNTIME_ASSERT(SetCurrentConsoleFontEx(out, FALSE, &cfi));
+
+	RUNTIME_ASSERT(SetConsoleActiveScreenBuffer(out));
+
+	RUNTIME_ASSERT(SetConsoleMode(in, ENABLE_WINDOW_INPUT | ENABLE_MOUSE_INPUT));
+	RUNTIME_ASSERT(SetConsoleMode(out, 0));
+	
+	screen_initialize_cursor();
+
+	RUNTIME_ASSERT(GetCurrentConsoleFontEx(out, FALSE, &cfi));
+
+	if (wcsncmp(cfi.FaceName, SCREEN_FONT, sizeof cfi.FaceName / sizeof * cfi.FaceName) != 0)
+	{
+		log_error("Failed to locate Dig-N-Rig's font!\n");
+	}
+}
+
+void screen_backend_destroy(void)
+{
+	CloseHandle(out);
+}
+
+void screen_backend_wake(void)
+{
+	INPUT_RECORD ir = { .EventType = MENU_EVENT, .Event.MenuEvent.dwCommandId = SCREEN_WAKE_COMMAND };
+	DWORD written;
+	WriteConsoleInputW(in, &ir, 1, &written);
+}
+
+/* Returns false once escape asks to quit */
+static bool screen_handle_record(const INPUT_RECORD* ir)
+{
+	if (ir->EventType == KEY_EVENT)
+	{
+		KEY_EVENT_RECORD ker = ir->Event.KeyEvent;
+		if (!ker.bKeyDown)
+		{
+			return true;
+		}
+		if (ker.wVirtualKeyCode == VK_ESCAPE)
+		{
+			return false;
+		}
+		screen_events.keyboard(ker.wVirtualKeyCode);
+	}
+	else if (ir->EventType == MENU_EVENT && ir->Event.MenuEvent.dwCommandId == SCREEN_WAKE_COMMAND)
+	{
+		if (screen_events.wake)
+		{
+			screen_events.wake();
+		}
+	}
+	else if (ir->EventType == WINDOW_BUFFER_SIZE_EVENT)
+	{
+		HWND console_window = GetConsoleWindow();
+
+		RECT fitted = (RECT){ .right = TARGET_WIDTH * TARGET_CELL_SIZE, .bottom = TARGET_HEIGHT * TARGET_CELL_SIZE };
+		RUNTIME_ASSERT(AdjustWindowRectEx(&fitted, GetWindowLongW(console_window, GWL_STYLE), FALSE, GetWindowLongW(console_window, GWL_EXSTYLE)));
+
+		RUNTIME_ASSERT(SetWindowPos(console_window, NULL, 0, 0, fitted.right - fitted.left, fitted.bottom - fitted.top, SWP_NOMOVE));
+		screen_initialize_cursor();
+		/* resizing can throw away what the console was showing */
+		screen_invalidate();
+		screen_repaint();
+
+		CONSOLE_SCREEN_BUFFER_INFOEX csbi = { .cbSize = sizeof csbi };
+		RUNTIME_ASSERT(GetConsoleScreenBufferInfoEx(out, &csbi));
+		if (csbi.dwSize.X != TARGET_WIDTH || csbi.dwSize.Y != TARGET_HEIGHT)
+		{
+			screen_initialize_output();
+		}
+	}
+	return true;
+}
+
+void screen_backend_loop(void)
+{
+	/* blocks for the first record, then takes every one already queued, so a held key's repeats arrive together */
+	INPUT_RECORD records[SCREEN_INPUT_BATCH];
+	DWORD read, pending;
+	while (ReadConsoleInputW(in, records, SCREEN_INPUT_BATCH, &read) && read > 0)
+	{
+		for (DWORD i = 0; i < read; i++)
+		{
+			if (!screen_handle_record(&records[i]))
+			{
+				return;
+			}
+		}
+		if (screen_events.input_drained && GetNumberOfConsoleInputEvents(in, &pending) && pending == 0)
+		{
+			screen_events.input_drained();
+		}
+	}
+}
+
+void screen_backend_change_title(const char* title)
+{
+	RUNTIME_ASSERT(SetConsoleTitleA(title));
+}
+
+void screen_backend_set_palettes(const uint32_t (*colors)[16], int count)
+{
+	(void)count;
+	palettes = colors;
+}
+
+void screen_backend_change_palette(int id)
+{
+	/* the console's color table is the palette, so the cells themselves never change */
+	memcpy(palette, palettes[id], sizeof palette);
+	screen_apply_palette();
+}
+
+void screen_backend_present(const cell_t frame[TARGET_HEIGHT][TARGET_WIDTH], const screen_region_t* regions, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		SMALL_RECT region = { .Left = regions[i].left, .Top = regions[i].top, .Right = regions[i].right - 1, .Bottom = regions[i].bottom - 1 };
+		RUNTIME_ASSERT(WriteConsoleOutputA(out, (const CHAR_INFO*)&frame[0][0], (COORD) { TARGET_WIDTH, TARGET_HEIGHT }, (COORD) { regions[i].left, regions[i].top }, &region));
+	}
+}
+
+#endif
\ No newline at end of file
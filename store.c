@@ -0,0 +1,244 @@
+/*
+	store.c ~ RL
+*/
+
+#include "store.h"
+
+#include "thread.h"
+#include <string.h>
+
+#define STORE_BUCKET_COUNT 4096
+/* Candidates a commit can rule out before it has to allocate room for more, hash collisions make even one rare */
+#define STORE_REJECTED_INLINE 8
+/* header rounded up so the plane after it keeps malloc's 16 byte alignment */
+#define STORE_HEADER_SIZE ((sizeof(struct store_entry) + 15) & ~(size_t)15)
+
+struct store_entry
+{
+	struct store_entry* next;
+	uint64_t hash;
+	size_t size;
+	int refs;
+};
+
+static struct store
+{
+	/* created by the first commit, held for bucket walks but never for comparing planes */
+	mutex_t lock;
+	volatile int32_t start_claim;
+	volatile int32_t is_started;
+	store_statistics_t statistics;
+	struct store_entry* buckets[STORE_BUCKET_COUNT];
+} store;
+
+static inline struct store_entry* store_header(const void* plane)
+{
+	return (struct store_entry*)((const char*)plane - STORE_HEADER_SIZE);
+}
+
+static inline void* store_plane(struct store_entry* entry)
+{
+	return (char*)entry + STORE_HEADER_SIZE;
+}
+
+static inline uint64_t store_mix(uint64_t hash)
+{
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCD;
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53;
+	return hash ^ hash >> 33;
+}
+
+/* Four independent multiply lanes over 32 byte blocks, so hashing a big plane isn't one long dependency chain like dig_hash */
+static uint64_t store_hash(const void* data, size_t size)
+{
+	const unsigned char* p = data;
+	uint64_t lanes[4] = { 0x9E3779B97F4A7C15, 0xBF58476D1CE4E5B9, 0x94D049BB133111EB, 0x2545F4914F6CDD1D };
+	for (; size >= 32; p += 32, size -= 32)
+	{
+		for (int lane = 0; lane < 4; lane++)
+		{
+			uint64_t word;
+			memcpy(&word, p + lane * 8, 8);
+			lanes[lane] = (lanes[lane] ^ word) * 0x9FB21C651E98DF25;
+			lanes[lane] ^= lanes[lane] >> 29;
+		}
+	}
+	uint64_t res = store_mix(lanes[0]) ^ store_mix(lanes[1] + 1) ^ store_mix(lanes[2] + 2) ^ store_mix(lanes[3] + 3);
+	for (; size > 0; p++, size--)
+	{
+		res = (res ^ *p) * 0x100000001B3;
+	}
+	return store_mix(res);
+}
+
+/* Like log_start, so the store works without anyone setting it up first */
+static void store_start(void)
+{
+	if (atomic_add32(&store.start_claim, 1) != 1)
+	{
+		while (!atomic_load32(&store.is_started))
+		{
+			thread_sleep(0);
+		}
+		return;
+	}
+	store.lock = mutex_create();
+	atomic_store32(&store.is_started, 1);
+}
+
+static void store_lock(void)
+{
+	if (!atomic_load32(&store.is_started))
+	{
+		store_start();
+	}
+	mutex_lock(store.lock);
+}
+
+static void store_unlock(void)
+{
+	mutex_unlock(store.lock);
+}
+
+/* Adds entry to its bucket with one reference, the lock must be held */
+static void store_insert(struct store_entry* entry)
+{
+	struct store_entry** bucket = &store.buckets[entry->hash % STORE_BUCKET_COUNT];
+	entry->refs = 1;
+	entry->next = *bucket;
+	*bucket = entry;
+	store.statistics.planes++;
+	store.statistics.bytes += entry->size;
+	store.statistics.references++;
+	store.statistics.referenced_bytes += entry->size;
+}
+
+void* store_reserve(size_t size)
+{
+	struct store_entry* entry = dig_malloc(STORE_HEADER_SIZE + size);
+	entry->size = size;
+	return store_plane(entry);
+}
+
+static bool store_is_rejected(const struct store_entry* candidate, struct store_entry* const* rejected, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (rejected[i] == candidate)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void* store_commit(void* plane)
+{
+	struct store_entry* entry = store_header(plane);
+	/* hashed before taking the lock, only the lookup is serialized */
+	entry->hash = store_hash(plane, entry->size);
+
+	/* candidates that turned out to differ, still referenced so none of them is freed and its address reused meanwhile */
+	struct store_entry* inline_rejected[STORE_REJECTED_INLINE];
+	struct store_entry** rejected = inline_rejected;
+	int rejected_count = 0, rejected_capacity = STORE_REJECTED_INLINE;
+	struct store_entry* match = NULL;
+	for (;;)
+	{
+		store_lock();
+		struct store_entry* candidate = store.buckets[entry->hash % STORE_BUCKET_COUNT];
+		while (candidate && (candidate->hash != entry->hash || candidate->size != entry->size || store_is_rejected(candidate, rejected, rejected_count)))
+		{
+			candidate = candidate->next;
+		}
+		if (!candidate)
+		{
+			/* nothing left to compare against, the plane is new or only collided with different ones */
+			store_insert(entry);
+			store_unlock();
+			break;
+		}
+		/* the reference keeps the candidate alive while it's compared without the lock */
+		candidate->refs++;
+		store.statistics.references++;
+		store.statistics.referenced_bytes += candidate->size;
+		store_unlock();
+
+		if (memcmp(store_plane(candidate), plane, entry->size) == 0)
+		{
+			match = candidate;
+			break;
+		}
+		if (rejected_count == rejected_capacity)
+		{
+			rejected_capacity *= 2;
+			struct store_entry** grown = dig_malloc(rejected_capacity * sizeof * grown);
+			memcpy(grown, rejected, rejected_count * sizeof * grown);
+			if (rejected != inline_rejected)
+			{
+				free(rejected);
+			}
+			rejected = grown;
+		}
+		rejected[rejected_count++] = candidate;
+	}
+
+	for (int i = 0; i < rejected_count; i++)
+	{
+		store_release(store_plane(rejected[i]));
+	}
+	if (rejected != inline_rejected)
+	{
+		free(rejected);
+	}
+	if (match)
+	{
+		free(entry);
+		return store_plane(match);
+	}
+	return plane;
+}
+
+size_t store_size(const void* plane)
+{
+	return store_header(plane)->size;
+}
+
+void store_release(const void* plane)
+{
+	if (!plane)
+	{
+		return;
+	}
+	struct store_entry* entry = store_header(plane);
+	store_lock();
+	store.statistics.references--;
+	store.statistics.referenced_bytes -= entry->size;
+	bool is_last = --entry->refs == 0;
+	if (is_last)
+	{
+		struct store_entry** link = &store.buckets[entry->hash % STORE_BUCKET_COUNT];
+		while (*link != entry)
+		{
+			link = &(*link)->next;
+		}
+		*link = entry->next;
+		store.statistics.planes--;
+		store.statistics.bytes -= entry->size;
+	}
+	store_unlock();
+
+	if (is_last)
+	{
+		free(entry);
+	}
+}
+
+void store_statistics(store_statistics_t* statistics)
+{
+	store_lock();
+	*statistics = store.statistics;
+	store_unlock();
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+/*
+	store.h ~ RL
+
+	Content-addressed, refcounted planes, so sprites with identical Image or Color data share one copy.
+*/
+
+#pragma once
+
+#include "types.h"
+
+typedef struct store_statistics
+{
+	/* distinct planes resident and the bytes they take */
+	int planes;
+	uint64_t bytes;
+	/* live references and the bytes they would take without sharing */
+	int references;
+	uint64_t referenced_bytes;
+} store_statistics_t;
+
+/* Space for a plane of size bytes, filled in by the caller and then handed to store_commit. Never returns NULL. */
+void* store_reserve(size_t size);
+/*
+	Returns the stored plane with the same bytes as the reserved one, holding a reference to it.
+	The reserved plane is freed if an equal one was already stored, otherwise it's kept and returned.
+*/
+void* store_commit(void* plane);
+/* Bytes in a plane from store_commit */
+size_t store_size(const void* plane);
+/* Drops a reference from store_commit, the plane is freed with its last one */
+void store_release(const void* plane);
+void store_statistics(store_statistics_t* statistics);
\ No newline at end of file
@@ -0,0 +1,385 @@
+/*
+	thread.c ~ RL
+*/
+
+#include "thread.h"
+
+#include "log.h"
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define THREAD_MAX_WORKERS 64
+#define THREAD_RANGE(begin, end) ((int64_t)(begin) << 32 | (uint32_t)(end))
+#define THREAD_RANGE_BEGIN(range) ((int32_t)((range) >> 32))
+#define THREAD_RANGE_END(range) ((int32_t)((range) & 0xFFFFFFFF))
+
+struct thread
+{
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+	thread_proc_t proc;
+	void* param;
+};
+
+struct mutex
+{
+#ifdef _WIN32
+	SRWLOCK lock;
+#else
+	pthread_mutex_t lock;
+#endif
+};
+
+struct condition
+{
+#ifdef _WIN32
+	CONDITION_VARIABLE variable;
+#else
+	pthread_cond_t variable;
+#endif
+};
+
+/*
+	Each slot owns a packed [begin, end) range of indices. The owner takes from the front,
+	thieves take the back half, and both sides commit with a single 64-bit compare exchange.
+*/
+struct pool_slot
+{
+	volatile int64_t range;
+	char padding[64 - sizeof(int64_t)];
+};
+
+static struct pool
+{
+	mutex_t submit;
+	mutex_t lock;
+	condition_t wake;
+	condition_t done;
+	int worker_count;
+	int generation;
+	int active;
+	thread_job_t job;
+	void* param;
+	struct pool_slot slots[THREAD_MAX_WORKERS + 1];
+} pool;
+
+#ifdef _WIN32
+static DWORD WINAPI thread_entry(LPVOID param)
+#else
+static void* thread_entry(void* param)
+#endif
+{
+	thread_t thread = param;
+	thread->proc(thread->param);
+	return 0;
+}
+
+thread_t thread_create(thread_proc_t proc, void* param)
+{
+	thread_t res = dig_malloc(sizeof * res);
+	res->proc = proc;
+	res->param = param;
+#ifdef _WIN32
+	res->handle = CreateThread(NULL, 0, thread_entry, res, 0, NULL);
+	if (!res->handle)
+#else
+	if (pthread_create(&res->handle, NULL, thread_entry, res) != 0)
+#endif
+	{
+		log_error("Failed to create thread\n");
+		free(res);
+		return NULL;
+	}
+	return res;
+}
+
+void thread_join(thread_t thread)
+{
+	if (!thread)
+	{
+		return;
+	}
+#ifdef _WIN32
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+#else
+	pthread_join(thread->handle, NULL);
+#endif
+	free(thread);
+}
+
+void thread_sleep(int milliseconds)
+{
+#ifdef _WIN32
+	Sleep(milliseconds);
+#else
+	struct timespec ts = { .tv_sec = milliseconds / 1000, .tv_nsec = (milliseconds % 1000) * 1000000L };
+	nanosleep(&ts, NULL);
+#endif
+}
+
+int thread_processor_count(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	int count = (int)info.dwNumberOfProcessors;
+#else
+	int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return count < 1 ? 1 : count;
+}
+
+mutex_t mutex_create(void)
+{
+	mutex_t res = dig_malloc(sizeof * res);
+#ifdef _WIN32
+	InitializeSRWLock(&res->lock);
+#else
+	pthread_mutex_init(&res->lock, NULL);
+#endif
+	return res;
+}
+
+void mutex_destroy(mutex_t mutex)
+{
+	if (!mutex)
+	{
+		return;
+	}
+#ifndef _WIN32
+	pthread_mutex_destroy(&mutex->lock);
+#endif
+	free(mutex);
+}
+
+void mutex_lock(mutex_t mutex)
+{
+#ifdef _WIN32
+	AcquireSRWLockExclusive(&mutex->lock);
+#else
+	pthread_mutex_lock(&mutex->lock);
+#endif
+}
+
+void mutex_unlock(mutex_t mutex)
+{
+#ifdef _WIN32
+	ReleaseSRWLockExclusive(&mutex->lock);
+#else
+	pthread_mutex_unlock(&mutex->lock);
+#endif
+}
+
+condition_t condition_create(void)
+{
+	condition_t res = dig_malloc(sizeof * res);
+#ifdef _WIN32
+	InitializeConditionVariable(&res->variable);
+#else
+	pthread_cond_init(&res->variable, NULL);
+#endif
+	return res;
+}
+
+void condition_destroy(condition_t condition)
+{
+	if (!condition)
+	{
+		return;
+	}
+#ifndef _WIN32
+	pthread_cond_destroy(&condition->variable);
+#endif
+	free(condition);
+}
+
+void condition_wait(condition_t condition, mutex_t mutex)
+{
+#ifdef _WIN32
+	SleepConditionVariableSRW(&condition->variable, &mutex->lock, INFINITE, 0);
+#else
+	pthread_cond_wait(&condition->variable, &mutex->lock);
+#endif
+}
+
+void condition_signal(condition_t condition)
+{
+#ifdef _WIN32
+	WakeConditionVariable(&condition->variable);
+#else
+	pthread_cond_signal(&condition->variable);
+#endif
+}
+
+void condition_broadcast(condition_t condition)
+{
+#ifdef _WIN32
+	WakeAllConditionVariable(&condition->variable);
+#else
+	pthread_cond_broadcast(&condition->variable);
+#endif
+}
+
+static int thread_pool_pop(struct pool_slot* slot)
+{
+	int64_t range = atomic_load64(&slot->range);
+	for (;;)
+	{
+		int begin = THREAD_RANGE_BEGIN(range), end = THREAD_RANGE_END(range);
+		if (begin >= end)
+		{
+			return -1;
+		}
+		int64_t seen = atomic_cas64(&slot->range, range, THREAD_RANGE(begin + 1, end));
+		if (seen == range)
+		{
+			return begin;
+		}
+		range = seen;
+	}
+}
+
+static bool thread_pool_steal(int thief)
+{
+	int slot_count = pool.worker_count + 1;
+	for (int i = 1; i < slot_count; i++)
+	{
+		struct pool_slot* victim = &pool.slots[(thief + i) % slot_count];
+		int64_t range = atomic_load64(&victim->range);
+		int begin = THREAD_RANGE_BEGIN(range), end = THREAD_RANGE_END(range);
+		if (begin >= end)
+		{
+			continue;
+		}
+		int split = end - (end - begin + 1) / 2;
+		if (atomic_cas64(&victim->range, range, THREAD_RANGE(begin, split)) == range)
+		{
+			/* our own range is empty, so only other thieves can be looking at it and they will not touch it */
+			int64_t own = atomic_load64(&pool.slots[thief].range);
+			while (atomic_cas64(&pool.slots[thief].range, own, THREAD_RANGE(split, end)) != own)
+			{
+				own = atomic_load64(&pool.slots[thief].range);
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+static void thread_pool_run(int slot)
+{
+	do
+	{
+		int index;
+		while ((index = thread_pool_pop(&pool.slots[slot])) >= 0)
+		{
+			pool.job(pool.param, index);
+		}
+	} while (thread_pool_steal(slot));
+}
+
+static void thread_pool_worker(void* param)
+{
+	int slot = (int)(intptr_t)param;
+	int seen = 0;
+	for (;;)
+	{
+		mutex_lock(pool.lock);
+		while (pool.generation == seen)
+		{
+			condition_wait(pool.wake, pool.lock);
+		}
+		seen = pool.generation;
+		mutex_unlock(pool.lock);
+
+		thread_pool_run(slot);
+
+		mutex_lock(pool.lock);
+		if (--pool.active == 0)
+		{
+			condition_signal(pool.done);
+		}
+		mutex_unlock(pool.lock);
+	}
+}
+
+static void thread_pool_initialize(void)
+{
+	pool.submit = mutex_create();
+	pool.lock = mutex_create();
+	pool.wake = condition_create();
+	pool.done = condition_create();
+
+	int workers = thread_processor_count() - 1;
+	workers = workers > THREAD_MAX_WORKERS ? THREAD_MAX_WORKERS : workers;
+	for (int i = 0; i < workers; i++)
+	{
+		/* workers are never joined, they sleep until the process exits */
+		if (!thread_create(thread_pool_worker, (void*)(intptr_t)(i + 1)))
+		{
+			break;
+		}
+		pool.worker_count++;
+	}
+}
+
+#ifdef _WIN32
+static BOOL CALLBACK thread_pool_initialize_once(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	thread_pool_initialize();
+	return TRUE;
+}
+#endif
+
+void thread_parallel_for(int count, thread_job_t job, void* param)
+{
+#ifdef _WIN32
+	static INIT_ONCE once = INIT_ONCE_STATIC_INIT;
+	InitOnceExecuteOnce(&once, thread_pool_initialize_once, NULL, NULL);
+#else
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, thread_pool_initialize);
+#endif
+
+	if (count <= 0)
+	{
+		return;
+	}
+
+	mutex_lock(pool.submit);
+
+	int slot_count = pool.worker_count + 1;
+	for (int i = 0; i < slot_count; i++)
+	{
+		pool.slots[i].range = THREAD_RANGE((int64_t)count * i / slot_count, (int64_t)count * (i + 1) / slot_count);
+	}
+
+	mutex_lock(pool.lock);
+	pool.job = job;
+	pool.param = param;
+	pool.active = pool.worker_count;
+	pool.generation++;
+	condition_broadcast(pool.wake);
+	mutex_unlock(pool.lock);
+
+	/* the calling thread works slot 0 */
+	thread_pool_run(0);
+
+	mutex_lock(pool.lock);
+	while (pool.active > 0)
+	{
+		condition_wait(pool.done, pool.lock);
+	}
+	mutex_unlock(pool.lock);
+
+	mutex_unlock(pool.submit);
+}
\ No newline at end of file
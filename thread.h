@@ -0,0 +1,83 @@
+/*
+	thread.h ~ RL
+
+	Thin wrapper over Win32 threads and pthreads, plus a work-stealing pool for bulk jobs.
+*/
+
+#pragma once
+
+#include "types.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+typedef struct thread* thread_t;
+typedef struct mutex* mutex_t;
+typedef struct condition* condition_t;
+
+typedef void (*thread_proc_t)(void* param);
+typedef void (*thread_job_t)(void* param, int index);
+
+thread_t thread_create(thread_proc_t proc, void* param);
+void thread_join(thread_t thread);
+void thread_sleep(int milliseconds);
+int thread_processor_count(void);
+
+/* Runs job(param, i) for every i in [0, count) across all cores, returns once every index is done. Not reentrant. */
+void thread_parallel_for(int count, thread_job_t job, void* param);
+
+mutex_t mutex_create(void);
+void mutex_destroy(mutex_t mutex);
+void mutex_lock(mutex_t mutex);
+void mutex_unlock(mutex_t mutex);
+
+condition_t condition_create(void);
+void condition_destroy(condition_t condition);
+void condition_wait(condition_t condition, mutex_t mutex);
+void condition_signal(condition_t condition);
+void condition_broadcast(condition_t condition);
+
+/* Returns the new value */
+static inline int32_t atomic_add32(volatile int32_t* p, int32_t value)
+{
+#ifdef _MSC_VER
+	return _InterlockedExchangeAdd((volatile long*)p, value) + value;
+#else
+	return __atomic_add_fetch(p, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline int32_t atomic_load32(volatile int32_t* p)
+{
+#ifdef _MSC_VER
+	return _InterlockedCompareExchange((volatile long*)p, 0, 0);
+#else
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void atomic_store32(volatile int32_t* p, int32_t value)
+{
+#ifdef _MSC_VER
+	_InterlockedExchange((volatile long*)p, value);
+#else
+	__atomic_store_n(p, value, __ATOMIC_RELEASE);
+#endif
+}
+
+/* Returns the value held before the exchange, which equals expected on success */
+static inline int64_t atomic_cas64(volatile int64_t* p, int64_t expected, int64_t desired)
+{
+#ifdef _MSC_VER
+	return _InterlockedCompareExchange64(p, desired, expected);
+#else
+	__atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return expected;
+#endif
+}
+
+static inline int64_t atomic_load64(volatile int64_t* p)
+{
+	return atomic_cas64(p, 0, 0);
+}
\ No newline at end of file
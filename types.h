@@ -15,6 +15,12 @@
 
 #define CREATE_ATTRIBUTE(fg, bg) ((fg) | (bg) << 4)
 
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
 /* 4-bit color, 0bIRGB */
 typedef enum color
 {
@@ -40,12 +46,32 @@ typedef uint16_t attribute_t;
 
 typedef struct sprite* sprite_t;
 
-extern inline void* dig_malloc(size_t size)
+#ifdef DIG_BENCH
+/* Number of dig_malloc calls made by the current thread, only counted in builds for the benchmarks */
+extern THREAD_LOCAL uint64_t dig_allocation_count;
+#endif
+
+static inline void* dig_malloc(size_t size)
 {
+#ifdef DIG_BENCH
+	dig_allocation_count++;
+#endif
 	void* res = malloc(size);
 	if (!res)
 	{
 		exit(-10);
 	}
 	return res;
+}
+
+/* FNV-1a, for cache names and content hashes */
+static inline uint64_t dig_hash(const void* data, size_t size)
+{
+	uint64_t hash = 0xCBF29CE484222325;
+	for (const unsigned char* p = data; p < (const unsigned char*)data + size; p++)
+	{
+		hash ^= *p;
+		hash *= 0x100000001B3;
+	}
+	return hash;
 }
\ No newline at end of file
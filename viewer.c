@@ -4,83 +4,961 @@
 	Views all Dig-N-Rig sprites found in the game's directory.
 */
 
+#include "arena.h"
+#include "bench.h"
+#include "export.h"
 #include "file.h"
+#include "log.h"
+#include "lru.h"
+#include "pack.h"
+#include "profile.h"
 #include "screen.h"
+#include "store.h"
+#include "thread.h"
+#include "watch.h"
 #include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
 
+#ifdef _WIN32
 /* Temporary, you'd need to actually find this programatically but it'll work most of the time */
-#define DIG_N_RIG_SPRITE_PATH "C:\\Program Files (x86)\\DigiPen\\Dig-N-Rig\\Sprites\\"
-#define DIG_N_RIG_LAYER_PATH "C:\\Program Files (x86)\\DigiPen\\Dig-N-Rig\\Layers\\"
+#define DIG_N_RIG_PATH "C:\\Program Files (x86)\\DigiPen\\Dig-N-Rig\\"
+#define PATH_SEPARATOR "\\"
+#else
+/* There's no install to find outside of Windows, so the game's files are expected in the working directory unless --game says otherwise */
+#define DIG_N_RIG_PATH "./"
+#define PATH_SEPARATOR "/"
+#define MAX_PATH 4096
+#endif
 
+/* Default size of the loaded sprite cache, can be overridden with --cache-bytes */
+#define VIEWER_CACHE_BYTES (64 * 1024 * 1024)
+/* How many sprites on either side of the current one are loaded ahead of time */
+#define VIEWER_PREFETCH_RADIUS 4
+/* Rows scrolled by the up and down arrows, page up/down scroll a whole screen */
+#define VIEWER_SCROLL_STEP 4
+/* Block size of the arenas holding directory paths and bulk loaded sprites */
+#define VIEWER_PATH_ARENA_SIZE (64 * 1024)
+#define VIEWER_SPRITE_ARENA_SIZE (16 * 1024 * 1024)
+/* Thumbnails on a gallery page, each tile keeps a cell of border for the selection */
+#define VIEWER_GALLERY_COLUMNS 5
+#define VIEWER_GALLERY_ROWS 5
+#define VIEWER_GALLERY_SIZE (VIEWER_GALLERY_COLUMNS * VIEWER_GALLERY_ROWS)
+#define VIEWER_TILE_WIDTH (TARGET_WIDTH / VIEWER_GALLERY_COLUMNS)
+#define VIEWER_TILE_HEIGHT (TARGET_HEIGHT / VIEWER_GALLERY_ROWS)
+/* Where the D key writes the timing histograms */
+#define VIEWER_PROFILE_PATH "profile.jsonl"
+/* Loaded from the game directory when there's no --palettes, see screen_load_palettes */
+#define VIEWER_PALETTES_FILE "Palettes.txt"
+
+static const char* game_path = DIG_N_RIG_PATH;
+/* with --profile everything is timed from the start and the histograms are written here on exit */
+static const char* profile_output;
 static sprite_t current;
+static int current_key = -1;
+static lru_t loaded;
 
-static int index;
+static int current_index;
+static int current_frame;
+/* top left cell of the sprite that's on screen, for sprites bigger than the screen */
+static int camera_x, camera_y;
 static bool is_viewing_sprites;
+/* the bottom row shows the latest timings */
+static bool is_overlay_shown;
 
+/* every path below lives here and is freed with it */
+static arena_t paths;
 /* there are 472 sprites in Dig-N-Rig, but just to be safe, we'll do 512... */
 static char* sprite_directories[512];
 static int sprite_directory_count;
 /* there are 32 layers in Dig-N-Rig, but again just to be safe, we'll do 64 */
 static char* layer_directories[64];
 static int layer_directory_count;
+/* with --pack the assets are ranges of the pack instead, and the directory arrays aren't used */
+static pack_t game_pack;
+static int sprite_first, layer_first;
+
+static struct prefetch
+{
+	thread_t thread;
+	mutex_t lock;
+	condition_t wake;
+	int generation;
+	int index;
+	bool is_viewing_sprites;
+	/* the UI missed the cache, so index itself is loaded before its neighbours */
+	bool is_index_wanted;
+	/* handed to the UI thread pinned, NULL if it failed to load, and loaded_key is -1 once it's taken */
+	int loaded_key;
+	sprite_t loaded_sprite;
+	/* the gallery page starting at index, with a bit for every tile the cache didn't have */
+	int page_count;
+	uint32_t page_missing;
+	/* its tiles as they load, handed over pinned like loaded_sprite, and -1 where nothing is waiting */
+	int page_keys[VIEWER_GALLERY_SIZE];
+	sprite_t page_sprites[VIEWER_GALLERY_SIZE];
+	bool quit;
+} prefetch;
+
+struct prefetch_page
+{
+	int first;
+	bool sprites;
+	uint32_t missing;
+	int generation;
+};
+
+/* key handlers only record what changed, it's acted on once the keys already waiting are all handled */
+static struct pending_input
+{
+	bool is_target_changed;
+	bool is_repaint_needed;
+} pending_input;
+/* the asset that last failed to load, its title says so until it's left */
+static int failed_key = -1;
+
+/* the gallery pins every sprite on its page, in the selected asset list, while it's open */
+static struct gallery
+{
+	bool is_open;
+	int first;
+	int count;
+	sprite_t sprites[VIEWER_GALLERY_SIZE];
+	/* drawn over the selected tile, only the border isn't transparent */
+	sprite_t cursor;
+} gallery;
+
+struct hot_reload_entry
+{
+	int key;
+	sprite_t sprite;
+};
+
+/*
+	A changed file is parsed on the watch thread, then queued here for the UI thread if its old version is pinned.
+	One entry per key, a newer reload of the same file replaces the one that's waiting.
+*/
+static struct hot_reload
+{
+	watch_t watch;
+	mutex_t lock;
+	struct hot_reload_entry* entries;
+	int count, capacity;
+} hot_reload;
 
-static void viewer_reload_sprite(void)
+static inline int viewer_cache_key(int index, bool is_sprite)
 {
-	char** directories = is_viewing_sprites ? sprite_directories : layer_directories;
-	sprite_t next = file_load_sprite(directories[index]);
-	char buf[MAX_PATH + 27];
-	if (!next)
+	return index << 1 | is_sprite;
+}
+
+/* Steps delta assets from index, wrapping around the list. A pack can have an empty folder, which only has index 0. */
+static inline int viewer_wrap_index(int index, int delta, int count)
+{
+	return count ? ((index + delta) % count + count) % count : 0;
+}
+
+static int viewer_asset_count(bool is_sprite)
+{
+	return is_sprite ? sprite_directory_count : layer_directory_count;
+}
+
+static const char* viewer_asset_name(bool is_sprite, int index)
+{
+	if (game_pack)
 	{
-		snprintf(buf, sizeof buf, "\"%s\" - Failed to load!", directories[index]);
-		screen_change_title(buf);
+		return pack_name(game_pack, (is_sprite ? sprite_first : layer_first) + index);
+	}
+	return is_sprite ? sprite_directories[index] : layer_directories[index];
+}
+
+static sprite_t viewer_asset_load(bool is_sprite, int index)
+{
+	if (game_pack)
+	{
+		file_status_t status;
+		return pack_load_sprite(game_pack, (is_sprite ? sprite_first : layer_first) + index, NULL, &status);
+	}
+	return file_load_sprite(is_sprite ? sprite_directories[index] : layer_directories[index]);
+}
+
+static bool viewer_prefetch_is_stale(int generation)
+{
+	mutex_lock(prefetch.lock);
+	bool res = prefetch.generation != generation || prefetch.quit;
+	mutex_unlock(prefetch.lock);
+	return res;
+}
+
+/* Hands the asset the UI is waiting for over pinned, unless the user moved on while it loaded */
+static void viewer_prefetch_deliver(int index, bool sprites, int generation)
+{
+	int key = viewer_cache_key(index, sprites);
+	sprite_t sprite = lru_acquire(loaded, key);
+	if (!sprite)
+	{
+		sprite = viewer_asset_load(sprites, index);
+		/* cached even when it's stale by now, the user may well come back to it */
+		sprite = sprite ? lru_insert(loaded, key, sprite, true) : NULL;
+	}
+	mutex_lock(prefetch.lock);
+	bool is_stale = prefetch.generation != generation;
+	if (!is_stale)
+	{
+		prefetch.loaded_key = key;
+		prefetch.loaded_sprite = sprite;
+	}
+	mutex_unlock(prefetch.lock);
+	if (!is_stale)
+	{
+		screen_wake();
+	}
+	else if (sprite)
+	{
+		lru_release(loaded, key);
+		/* a reload of it may have been waiting on that pin */
+		screen_wake();
+	}
+}
+
+/* Loads one missing tile of a gallery page on the thread pool and hands it over as soon as it's done */
+static void viewer_prefetch_page_job(void* param, int slot)
+{
+	const struct prefetch_page* page = param;
+	if (!(page->missing >> slot & 1) || viewer_prefetch_is_stale(page->generation))
+	{
+		return;
+	}
+	int key = viewer_cache_key(page->first + slot, page->sprites);
+	sprite_t sprite = lru_acquire(loaded, key);
+	if (!sprite)
+	{
+		sprite = viewer_asset_load(page->sprites, page->first + slot);
+		sprite = sprite ? lru_insert(loaded, key, sprite, true) : NULL;
+	}
+	if (!sprite)
+	{
+		/* the tile stays empty */
 		return;
 	}
-	screen_sprite_destroy(current);
-	current = next;
+	mutex_lock(prefetch.lock);
+	bool is_stale = prefetch.generation != page->generation;
+	/* a tile the UI never took from an earlier page goes, so its pin isn't lost */
+	int old_key = is_stale ? -1 : prefetch.page_keys[slot];
+	if (!is_stale)
+	{
+		prefetch.page_keys[slot] = key;
+		prefetch.page_sprites[slot] = sprite;
+	}
+	mutex_unlock(prefetch.lock);
+	if (old_key >= 0)
+	{
+		lru_release(loaded, old_key);
+	}
+	if (is_stale)
+	{
+		lru_release(loaded, key);
+	}
+	/* a reload may have been waiting on a pin that just went, so the UI is woken either way */
+	screen_wake();
+}
+
+static void viewer_prefetch_thread(void* param)
+{
+	(void)param;
+	int seen = 0;
+	for (;;)
+	{
+		mutex_lock(prefetch.lock);
+		while (prefetch.generation == seen && !prefetch.quit)
+		{
+			condition_wait(prefetch.wake, prefetch.lock);
+		}
+		if (prefetch.quit)
+		{
+			mutex_unlock(prefetch.lock);
+			return;
+		}
+		seen = prefetch.generation;
+		int center = prefetch.index;
+		bool sprites = prefetch.is_viewing_sprites;
+		bool is_index_wanted = prefetch.is_index_wanted;
+		struct prefetch_page page = { center, sprites, prefetch.page_missing, seen };
+		int page_count = prefetch.page_count;
+		mutex_unlock(prefetch.lock);
+
+		if (page_count)
+		{
+			/* every core, like a bulk load, since the whole page is on screen waiting */
+			thread_parallel_for(page_count, viewer_prefetch_page_job, &page);
+			continue;
+		}
+
+		int dir_count = viewer_asset_count(sprites);
+		if (is_index_wanted && center < dir_count)
+		{
+			viewer_prefetch_deliver(center, sprites, seen);
+		}
 
-	snprintf(buf, sizeof buf, "\"%s\" - Width: %i, Height: %i", directories[index], screen_sprite_width(current), screen_sprite_height(current));
+		/* nearest neighbours first, giving up as soon as the user has moved on */
+		for (int i = 1; i <= VIEWER_PREFETCH_RADIUS * 2 && dir_count && !viewer_prefetch_is_stale(seen); i++)
+		{
+			int offset = i % 2 ? (i + 1) / 2 : -i / 2;
+			int neighbour = viewer_wrap_index(center, offset, dir_count);
+			int key = viewer_cache_key(neighbour, sprites);
+			if (lru_contains(loaded, key))
+			{
+				continue;
+			}
+			sprite_t sprite = viewer_asset_load(sprites, neighbour);
+			if (sprite)
+			{
+				lru_insert(loaded, key, sprite, false);
+			}
+		}
+	}
+}
+
+/* Every request cancels the ones before it, whatever the loader hasn't started on is dropped */
+static void viewer_prefetch_around(int index, bool is_sprite, bool is_index_wanted)
+{
+	mutex_lock(prefetch.lock);
+	prefetch.index = index;
+	prefetch.is_viewing_sprites = is_sprite;
+	prefetch.is_index_wanted = is_index_wanted;
+	prefetch.page_count = 0;
+	prefetch.generation++;
+	condition_signal(prefetch.wake);
+	mutex_unlock(prefetch.lock);
+}
+
+/* Loads the gallery page's missing tiles instead, cancelling whatever was requested before */
+static void viewer_prefetch_page(int first, int count, bool is_sprite, uint32_t missing)
+{
+	mutex_lock(prefetch.lock);
+	prefetch.index = first;
+	prefetch.is_viewing_sprites = is_sprite;
+	prefetch.is_index_wanted = false;
+	prefetch.page_count = count;
+	prefetch.page_missing = missing;
+	prefetch.generation++;
+	condition_signal(prefetch.wake);
+	mutex_unlock(prefetch.lock);
+}
+
+static void viewer_update_title(void)
+{
+	if (!viewer_asset_count(is_viewing_sprites))
+	{
+		screen_change_title(is_viewing_sprites ? "No sprites" : "No layers");
+		return;
+	}
+	if (gallery.is_open)
+	{
+		char buf[MAX_PATH + 64];
+		int count = viewer_asset_count(is_viewing_sprites);
+		snprintf(buf, sizeof buf, "Gallery - \"%s\" - Page: %i/%i", viewer_asset_name(is_viewing_sprites, current_index),
+			current_index / VIEWER_GALLERY_SIZE + 1, (count + VIEWER_GALLERY_SIZE - 1) / VIEWER_GALLERY_SIZE);
+		screen_change_title(buf);
+		return;
+	}
+	const char* name = viewer_asset_name(is_viewing_sprites, current_index);
+	char buf[MAX_PATH + 64];
+	int key = viewer_cache_key(current_index, is_viewing_sprites);
+	if (key != current_key)
+	{
+		/* the last sprite stays up until this one arrives */
+		snprintf(buf, sizeof buf, "\"%s\" - %s", name, key == failed_key ? "Failed to load!" : "Loading...");
+		screen_change_title(buf);
+		return;
+	}
+	int width = screen_sprite_width(current), height = screen_sprite_height(current);
+	int frame_count = screen_sprite_frame_count(current);
+	int len = snprintf(buf, sizeof buf, "\"%s\" - Width: %i, Height: %i", name, width, height);
+	if (frame_count > 1)
+	{
+		len += snprintf(buf + len, sizeof buf - len, ", Frame: %i/%i", current_frame + 1, frame_count);
+	}
+	if (width > TARGET_WIDTH || height > TARGET_HEIGHT)
+	{
+		snprintf(buf + len, sizeof buf - len, ", View: %i,%i", camera_x, camera_y);
+	}
 	screen_change_title(buf);
+}
+
+/* Takes over the pin on sprite and puts it on screen in place of the current one */
+static void viewer_show_sprite(int key, sprite_t sprite)
+{
+	if (current)
+	{
+		lru_release(loaded, current_key);
+	}
+	current = sprite;
+	current_key = key;
+	current_frame = 0;
+	/* big sprites start centered, like the ones that fit */
+	camera_x = screen_sprite_width(current) > TARGET_WIDTH ? (screen_sprite_width(current) - TARGET_WIDTH) / 2 : 0;
+	camera_y = screen_sprite_height(current) > TARGET_HEIGHT ? (screen_sprite_height(current) - TARGET_HEIGHT) / 2 : 0;
+}
+
+/* Shows the asset at current_index straight from the cache, or leaves the last one up while the loader fetches it */
+static void viewer_request_sprite(void)
+{
+	if (!viewer_asset_count(is_viewing_sprites))
+	{
+		/* nothing to show, so the last asset from the other list goes too */
+		if (current)
+		{
+			lru_release(loaded, current_key);
+		}
+		current = NULL;
+		current_key = -1;
+		return;
+	}
+	int key = viewer_cache_key(current_index, is_viewing_sprites);
+	sprite_t next = key == current_key ? NULL : lru_acquire(loaded, key);
+	viewer_prefetch_around(current_index, is_viewing_sprites, !next && key != current_key);
+	if (next)
+	{
+		viewer_show_sprite(key, next);
+	}
+}
+
+/* Runs on the UI thread after the loader delivers, anything that's no longer wanted is let go */
+static void viewer_receive_sprite(void)
+{
+	mutex_lock(prefetch.lock);
+	int key = prefetch.loaded_key;
+	sprite_t sprite = prefetch.loaded_sprite;
+	prefetch.loaded_key = -1;
+	prefetch.loaded_sprite = NULL;
+	mutex_unlock(prefetch.lock);
+	if (key < 0)
+	{
+		return;
+	}
+	if (gallery.is_open || key == current_key || key != viewer_cache_key(current_index, is_viewing_sprites))
+	{
+		if (sprite)
+		{
+			lru_release(loaded, key);
+		}
+		return;
+	}
+	if (sprite)
+	{
+		viewer_show_sprite(key, sprite);
+	}
+	else
+	{
+		failed_key = key;
+	}
+	viewer_update_title();
 	screen_repaint();
 }
 
+/* The palette sprite picks, falling back to the default like the export does when it picks none or one the palettes don't have */
+static void viewer_apply_palette(sprite_t sprite)
+{
+	int palette = sprite ? screen_sprite_palette(sprite) : -1;
+	screen_change_color_palette(palette >= 0 && palette < screen_palette_count() ? palette : SCREEN_DEFAULT_PALETTE);
+}
+
 void viewer_handle_repaint()
 {
-	screen_sprite_render(TARGET_WIDTH / 2 - screen_sprite_width(current) / 2, TARGET_HEIGHT / 2 - screen_sprite_height(current) / 2, current);
+	/* switching is free when it's the palette already in use, so every frame just asks for the one it needs */
+	int selected = current_index - gallery.first;
+	viewer_apply_palette(gallery.is_open ? (selected >= 0 && selected < gallery.count ? gallery.sprites[selected] : NULL) : current);
+	if (gallery.is_open)
+	{
+		/* thumbnails come from mip levels built at load, so this is a few small copies per tile */
+		for (int slot = 0; slot < gallery.count; slot++)
+		{
+			int x = slot % VIEWER_GALLERY_COLUMNS * VIEWER_TILE_WIDTH, y = slot / VIEWER_GALLERY_COLUMNS * VIEWER_TILE_HEIGHT;
+			if (gallery.sprites[slot])
+			{
+				screen_sprite_render_thumbnail(x + 1, y + 1, VIEWER_TILE_WIDTH - 2, VIEWER_TILE_HEIGHT - 2, gallery.sprites[slot]);
+			}
+			if (gallery.first + slot == current_index)
+			{
+				screen_sprite_render(x, y, gallery.cursor);
+			}
+		}
+	}
+	else if (current)
+	{
+		/* centered along an axis where it fits, otherwise the camera picks the part that's shown */
+		int width = screen_sprite_width(current), height = screen_sprite_height(current);
+		int x = width > TARGET_WIDTH ? -camera_x : TARGET_WIDTH / 2 - width / 2;
+		int y = height > TARGET_HEIGHT ? -camera_y : TARGET_HEIGHT / 2 - height / 2;
+		screen_sprite_render_frame(x, y, current, current_frame);
+	}
+
+	if (is_overlay_shown)
+	{
+		/* padded out so it's a solid bar over whatever is under it */
+		char summary[TARGET_WIDTH + 1];
+		profile_summary(summary, sizeof summary);
+		snprintf(summary + strlen(summary), sizeof summary - strlen(summary), "%*s", (int)(sizeof summary - 1 - strlen(summary)), "");
+		screen_text_render(0, TARGET_HEIGHT - 1, summary, CREATE_ATTRIBUTE(LIGHT_WHITE, DARK_BLUE));
+	}
+}
+
+/* Moves the camera while keeping it over the sprite, returns false if it didn't move */
+static bool viewer_move_camera(int x, int y)
+{
+	int max_x = screen_sprite_width(current) - TARGET_WIDTH, max_y = screen_sprite_height(current) - TARGET_HEIGHT;
+	x = x > max_x ? max_x : x;
+	y = y > max_y ? max_y : y;
+	x = x < 0 ? 0 : x;
+	y = y < 0 ? 0 : y;
+	bool res = x != camera_x || y != camera_y;
+	camera_x = x;
+	camera_y = y;
+	return res;
+}
+
+static void viewer_scroll(int dx, int dy)
+{
+	if (current && viewer_move_camera(camera_x + dx, camera_y + dy))
+	{
+		pending_input.is_repaint_needed = true;
+	}
+}
+
+static void viewer_gallery_release(void)
+{
+	for (int slot = 0; slot < gallery.count; slot++)
+	{
+		if (gallery.sprites[slot])
+		{
+			lru_release(loaded, viewer_cache_key(gallery.first + slot, is_viewing_sprites));
+			gallery.sprites[slot] = NULL;
+		}
+	}
+	gallery.count = 0;
+}
+
+/* Where key is on the open gallery page, or -1 */
+static int viewer_gallery_slot(int key)
+{
+	int index = key >> 1;
+	bool is_sprite = key & 1;
+	return gallery.count && is_sprite == is_viewing_sprites && index >= gallery.first && index < gallery.first + gallery.count ? index - gallery.first : -1;
+}
+
+/* Pins the page holding current_index, the tiles the cache doesn't have fill in as the loader delivers them */
+static void viewer_gallery_load_page(void)
+{
+	int first = current_index - current_index % VIEWER_GALLERY_SIZE;
+	if (gallery.count && first == gallery.first)
+	{
+		return;
+	}
+	viewer_gallery_release();
+	int count = viewer_asset_count(is_viewing_sprites) - first;
+	gallery.first = first;
+	gallery.count = count < VIEWER_GALLERY_SIZE ? count : VIEWER_GALLERY_SIZE;
+
+	/* one bit per tile, VIEWER_GALLERY_SIZE is under 32 */
+	uint32_t missing = 0;
+	for (int slot = 0; slot < gallery.count; slot++)
+	{
+		gallery.sprites[slot] = lru_acquire(loaded, viewer_cache_key(first + slot, is_viewing_sprites));
+		missing |= (uint32_t)!gallery.sprites[slot] << slot;
+	}
+	/* sent even when nothing is missing, so the last page stops loading */
+	viewer_prefetch_page(first, gallery.count, is_viewing_sprites, missing);
+}
+
+/* Runs on the UI thread after the loader delivers gallery tiles, the ones not on the open page anymore are let go */
+static void viewer_receive_tiles(void)
+{
+	int keys[VIEWER_GALLERY_SIZE];
+	sprite_t sprites[VIEWER_GALLERY_SIZE];
+	mutex_lock(prefetch.lock);
+	for (int i = 0; i < VIEWER_GALLERY_SIZE; i++)
+	{
+		keys[i] = prefetch.page_keys[i];
+		sprites[i] = prefetch.page_sprites[i];
+		prefetch.page_keys[i] = -1;
+		prefetch.page_sprites[i] = NULL;
+	}
+	mutex_unlock(prefetch.lock);
+
+	bool is_filled = false;
+	for (int i = 0; i < VIEWER_GALLERY_SIZE; i++)
+	{
+		if (keys[i] < 0)
+		{
+			continue;
+		}
+		int slot = viewer_gallery_slot(keys[i]);
+		if (gallery.is_open && slot >= 0 && !gallery.sprites[slot])
+		{
+			gallery.sprites[slot] = sprites[i];
+			is_filled = true;
+		}
+		else
+		{
+			lru_release(loaded, keys[i]);
+		}
+	}
+	if (is_filled)
+	{
+		screen_repaint();
+	}
+}
+
+static void viewer_gallery_select(int index)
+{
+	int count = viewer_asset_count(is_viewing_sprites);
+	current_index = index >= count ? count - 1 : index;
+	current_index = current_index < 0 ? 0 : current_index;
+	pending_input.is_target_changed = true;
+}
+
+static void viewer_gallery_open(void)
+{
+	gallery.is_open = true;
+	viewer_gallery_select(current_index);
+}
+
+static void viewer_gallery_close(void)
+{
+	viewer_gallery_release();
+	gallery.is_open = false;
+	pending_input.is_target_changed = true;
+}
+
+static void viewer_gallery_create_cursor(void)
+{
+	char text[VIEWER_TILE_WIDTH * VIEWER_TILE_HEIGHT];
+	attribute_t attrib[VIEWER_TILE_WIDTH * VIEWER_TILE_HEIGHT];
+	uint8_t transparency[VIEWER_TILE_WIDTH * VIEWER_TILE_HEIGHT];
+	for (int y = 0; y < VIEWER_TILE_HEIGHT; y++)
+	{
+		for (int x = 0; x < VIEWER_TILE_WIDTH; x++)
+		{
+			bool is_row_edge = y == 0 || y == VIEWER_TILE_HEIGHT - 1, is_column_edge = x == 0 || x == VIEWER_TILE_WIDTH - 1;
+			int i = y * VIEWER_TILE_WIDTH + x;
+			text[i] = is_row_edge && is_column_edge ? '+' : is_row_edge ? '-' : '|';
+			attrib[i] = CREATE_ATTRIBUTE(LIGHT_YELLOW, DARK_BLACK);
+			transparency[i] = !is_row_edge && !is_column_edge;
+		}
+	}
+	gallery.cursor = screen_sprite_create_frames(&(sprite_data_t) { VIEWER_TILE_WIDTH, VIEWER_TILE_HEIGHT, 1, -1, text, attrib, transparency, NULL }, NULL);
+}
+
+/* Called with hot_reload.lock held, takes ownership of sprite */
+static void viewer_queue_reload(int key, sprite_t sprite)
+{
+	for (int i = 0; i < hot_reload.count; i++)
+	{
+		if (hot_reload.entries[i].key == key)
+		{
+			screen_sprite_destroy(hot_reload.entries[i].sprite);
+			hot_reload.entries[i].sprite = sprite;
+			return;
+		}
+	}
+	if (hot_reload.count == hot_reload.capacity)
+	{
+		hot_reload.capacity = hot_reload.capacity ? hot_reload.capacity * 2 : 8;
+		struct hot_reload_entry* entries = dig_malloc(hot_reload.capacity * sizeof * entries);
+		if (hot_reload.count)
+		{
+			memcpy(entries, hot_reload.entries, hot_reload.count * sizeof * entries);
+		}
+		free(hot_reload.entries);
+		hot_reload.entries = entries;
+	}
+	hot_reload.entries[hot_reload.count++] = (struct hot_reload_entry){ key, sprite };
+}
+
+/* Runs on the watch thread once a file has stopped changing */
+static void viewer_handle_change(void* param, const char* path)
+{
+	(void)param;
+	int key = -1;
+	for (int i = 0; i < sprite_directory_count && key < 0; i++)
+	{
+		key = strcmp(sprite_directories[i], path) == 0 ? viewer_cache_key(i, true) : -1;
+	}
+	for (int i = 0; i < layer_directory_count && key < 0; i++)
+	{
+		key = strcmp(layer_directories[i], path) == 0 ? viewer_cache_key(i, false) : -1;
+	}
+	if (key < 0)
+	{
+		/* new files aren't listed until the viewer is restarted */
+		return;
+	}
+
+	/* copied rather than mapped, the file can still be rewritten under the parser */
+	file_view_t view;
+	if (!file_read(path, &view))
+	{
+		return;
+	}
+	file_status_t status;
+	sprite_t sprite = file_load_sprite_view(path, &view, NULL, &status);
+	file_unmap(&view);
+	if (!sprite)
+	{
+		/* probably saved mid-edit, the last good version stays up */
+		return;
+	}
+	/* a pinned entry is on screen, or on its way there from the loader, so the UI thread swaps it in */
+	if (lru_replace(loaded, key, sprite, false))
+	{
+		return;
+	}
+	mutex_lock(hot_reload.lock);
+	viewer_queue_reload(key, sprite);
+	mutex_unlock(hot_reload.lock);
+	screen_wake();
+}
+
+/*
+	Swaps a reloaded sprite in for the pinned one on the UI thread. Returns false while the loader still pins it,
+	then the reload waits for the next wake.
+*/
+static bool viewer_apply_reload(int key, sprite_t sprite)
+{
+	bool is_current = key == current_key;
+	int slot = viewer_gallery_slot(key);
+	/* every pin the UI thread holds goes, so only the loader's can make the swap fail, then they're taken again */
+	int held = is_current + (slot >= 0 && gallery.sprites[slot]);
+	int wanted = is_current + (slot >= 0);
+	for (int i = 0; i < held; i++)
+	{
+		lru_release(loaded, key);
+	}
+	sprite_t res = lru_replace(loaded, key, sprite, wanted > 0);
+	for (int i = res ? 1 : 0; i < (res ? wanted : held); i++)
+	{
+		lru_acquire(loaded, key);
+	}
+	if (!res)
+	{
+		return false;
+	}
+	if (slot >= 0)
+	{
+		gallery.sprites[slot] = res;
+	}
+	if (is_current)
+	{
+		current = res;
+		current_frame = current_frame < screen_sprite_frame_count(current) ? current_frame : 0;
+		viewer_move_camera(camera_x, camera_y);
+	}
+	return true;
+}
+
+void viewer_handle_wake()
+{
+	/* first, so a sprite the loader pinned for the UI is either shown or let go before it's reloaded */
+	viewer_receive_sprite();
+	viewer_receive_tiles();
+	if (!hot_reload.lock)
+	{
+		return;
+	}
+	mutex_lock(hot_reload.lock);
+	struct hot_reload_entry* entries = hot_reload.entries;
+	int count = hot_reload.count;
+	hot_reload.entries = NULL;
+	hot_reload.count = hot_reload.capacity = 0;
+	mutex_unlock(hot_reload.lock);
+
+	bool is_shown = false;
+	for (int i = 0; i < count; i++)
+	{
+		int key = entries[i].key;
+		if (!viewer_apply_reload(key, entries[i].sprite))
+		{
+			mutex_lock(hot_reload.lock);
+			/* a newer reload of the same file may have come in meanwhile, that one wins */
+			bool is_newer = false;
+			for (int j = 0; j < hot_reload.count && !is_newer; j++)
+			{
+				is_newer = hot_reload.entries[j].key == key;
+			}
+			if (is_newer)
+			{
+				screen_sprite_destroy(entries[i].sprite);
+			}
+			else
+			{
+				viewer_queue_reload(key, entries[i].sprite);
+			}
+			mutex_unlock(hot_reload.lock);
+			continue;
+		}
+		is_shown |= key == current_key || viewer_gallery_slot(key) >= 0;
+	}
+	free(entries);
+	if (is_shown)
+	{
+		viewer_update_title();
+		screen_repaint();
+	}
+}
+
+static void viewer_handle_gallery_keyboard(virtual_key_t vk)
+{
+	int dir_count = viewer_asset_count(is_viewing_sprites);
+	switch (vk)
+	{
+	case VK_LEFT:
+		viewer_gallery_select(viewer_wrap_index(current_index, -1, dir_count));
+		break;
+	case VK_RIGHT:
+		viewer_gallery_select(viewer_wrap_index(current_index, 1, dir_count));
+		break;
+	case VK_UP:
+		viewer_gallery_select(current_index - VIEWER_GALLERY_COLUMNS);
+		break;
+	case VK_DOWN:
+		viewer_gallery_select(current_index + VIEWER_GALLERY_COLUMNS);
+		break;
+	case VK_PRIOR:
+		viewer_gallery_select(current_index - VIEWER_GALLERY_SIZE);
+		break;
+	case VK_NEXT:
+		viewer_gallery_select(current_index + VIEWER_GALLERY_SIZE);
+		break;
+	case 'S':
+		viewer_gallery_release();
+		is_viewing_sprites = !is_viewing_sprites;
+		viewer_gallery_select(0);
+		break;
+	/* opens the selected asset */
+	case VK_RETURN:
+	case 'G':
+		viewer_gallery_close();
+		break;
+	}
 }
 
 void viewer_handle_keyboard(virtual_key_t vk)
 {
-	int dir_count = is_viewing_sprites ? sprite_directory_count : layer_directory_count;
+	switch (vk)
+	{
+	case 'P':
+		/* timing only runs while the overlay is up, unless --profile turned it on for the whole run */
+		is_overlay_shown = !is_overlay_shown;
+		profile_enable(is_overlay_shown || profile_output);
+		pending_input.is_repaint_needed = true;
+		return;
+	case 'D':
+		if (profile_dump(VIEWER_PROFILE_PATH))
+		{
+			screen_change_title("Wrote " VIEWER_PROFILE_PATH);
+		}
+		return;
+	}
+	if (gallery.is_open)
+	{
+		viewer_handle_gallery_keyboard(vk);
+		return;
+	}
+	int dir_count = viewer_asset_count(is_viewing_sprites);
 	switch (vk)
 	{
 	case VK_LEFT:
-		index = ((index + dir_count) - 1) % dir_count;
-		viewer_reload_sprite();
+		current_index = viewer_wrap_index(current_index, -1, dir_count);
+		pending_input.is_target_changed = true;
 		break;
 	case VK_RIGHT:
-		index = (index + 1) % dir_count;
-		viewer_reload_sprite();
+		current_index = viewer_wrap_index(current_index, 1, dir_count);
+		pending_input.is_target_changed = true;
 		break;
 	case 'S':
 		is_viewing_sprites = !is_viewing_sprites;
-		index = 0;
-		viewer_reload_sprite();
+		current_index = 0;
+		pending_input.is_target_changed = true;
+		break;
+	case VK_UP:
+		viewer_scroll(0, -VIEWER_SCROLL_STEP);
+		break;
+	case VK_DOWN:
+		viewer_scroll(0, VIEWER_SCROLL_STEP);
+		break;
+	case VK_PRIOR:
+		viewer_scroll(0, -TARGET_HEIGHT);
+		break;
+	case VK_NEXT:
+		viewer_scroll(0, TARGET_HEIGHT);
+		break;
+	/* left and right already flip through assets, so horizontal scrolling is on home and end */
+	case VK_HOME:
+		viewer_scroll(-TARGET_WIDTH / 2, 0);
+		break;
+	case VK_END:
+		viewer_scroll(TARGET_WIDTH / 2, 0);
+		break;
+	case 'F':
+		/* steps through the frames of animated sprites */
+		if (current && screen_sprite_frame_count(current) > 1)
+		{
+			current_frame = (current_frame + 1) % screen_sprite_frame_count(current);
+			pending_input.is_repaint_needed = true;
+		}
+		break;
+	case 'G':
+		viewer_gallery_open();
 		break;
 	}
 }
 
-static int viewer_initialize_directories(const char* base, char** directories, size_t directory_count)
+/* A held arrow key arrives as a burst, so only where it stops is loaded and drawn */
+void viewer_handle_input_drained()
+{
+	if (pending_input.is_target_changed)
+	{
+		if (gallery.is_open)
+		{
+			viewer_gallery_load_page();
+		}
+		else
+		{
+			viewer_request_sprite();
+		}
+	}
+	if (pending_input.is_target_changed || pending_input.is_repaint_needed)
+	{
+		viewer_update_title();
+		screen_repaint();
+	}
+	pending_input = (struct pending_input) { 0 };
+}
+
+#ifndef _WIN32
+static int viewer_compare_directories(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+#endif
+
+static int viewer_initialize_directories(const char* base, char** directories, int directory_count)
 {
 	int count = 0;
 
+#ifdef _WIN32
 	WIN32_FIND_DATAA ffd;
 	char base_buf[MAX_PATH];
 	snprintf(base_buf, sizeof base_buf, "%s*", base);
 	HANDLE find = FindFirstFileA(base_buf, &ffd);
 	if (find == INVALID_HANDLE_VALUE)
 	{
-		debug_format("Failed to locate Dig-N-Rig.\n");
+		log_error("Failed to locate Dig-N-Rig.\n");
 		exit(1);
 	}
 
@@ -91,7 +969,7 @@ static int viewer_initialize_directories(const char* base, char** directories, s
 		{
 			/* plus one for null terminator */
 			size_t dir_len = strnlen(ffd.cFileName, sizeof ffd.cFileName) + size_of_base + 1;
-			directories[count] = dig_malloc(dir_len);
+			directories[count] = arena_alloc(paths, dir_len);
 			snprintf(directories[count], dir_len, "%s%s", base, ffd.cFileName);
 			count++;
 		}
@@ -99,38 +977,476 @@ static int viewer_initialize_directories(const char* base, char** directories, s
 
 	if (count > directory_count)
 	{
-		debug_format("Ran out of space to store the rest of the directories\n");
+		log_warning("Ran out of space to store the rest of the directories\n");
 	}
 
 	FindClose(find);
+#else
+	DIR* dir = opendir(base);
+	if (!dir)
+	{
+		log_error("Failed to locate Dig-N-Rig.\n");
+		exit(1);
+	}
+
+	size_t size_of_base = strlen(base);
+	struct dirent* entry;
+	while ((entry = readdir(dir)) && directory_count > count)
+	{
+		/* plus one for null terminator */
+		size_t dir_len = strlen(entry->d_name) + size_of_base + 1;
+		char path[MAX_PATH];
+		snprintf(path, sizeof path, "%s%s", base, entry->d_name);
+		struct stat st;
+		if (dir_len > sizeof path || stat(path, &st) != 0 || S_ISDIR(st.st_mode))
+		{
+			continue;
+		}
+		directories[count++] = arena_strdup(paths, path);
+	}
+	closedir(dir);
+
+	/* FindFirstFile lists NTFS directories alphabetically, readdir makes no promises */
+	qsort(directories, count, sizeof * directories, viewer_compare_directories);
+#endif
 
 	return count;
 }
 
-static void viewer_initialize(void)
+static void viewer_initialize(const char* pack_path)
 {
-	sprite_directory_count = viewer_initialize_directories(DIG_N_RIG_SPRITE_PATH, sprite_directories, sizeof sprite_directories / sizeof * sprite_directories);
-	layer_directory_count = viewer_initialize_directories(DIG_N_RIG_LAYER_PATH, layer_directories, sizeof layer_directories / sizeof * layer_directories);
+	if (pack_path)
+	{
+		/* one open and one map, the index already knows every asset */
+		game_pack = pack_open(pack_path);
+		if (!game_pack)
+		{
+			exit(1);
+		}
+		sprite_directory_count = pack_range(game_pack, "Sprites/", &sprite_first);
+		layer_directory_count = pack_range(game_pack, "Layers/", &layer_first);
+		return;
+	}
 
-	viewer_reload_sprite();
+	paths = arena_create(VIEWER_PATH_ARENA_SIZE, false);
+	char sprite_path[MAX_PATH], layer_path[MAX_PATH];
+	snprintf(sprite_path, sizeof sprite_path, "%sSprites" PATH_SEPARATOR, game_path);
+	snprintf(layer_path, sizeof layer_path, "%sLayers" PATH_SEPARATOR, game_path);
+	sprite_directory_count = viewer_initialize_directories(sprite_path, sprite_directories, (int)(sizeof sprite_directories / sizeof * sprite_directories));
+	layer_directory_count = viewer_initialize_directories(layer_path, layer_directories, (int)(sizeof layer_directories / sizeof * layer_directories));
+}
+
+static int viewer_validate_directories(bool is_sprite)
+{
+	static const char* status_names[] = { "ok", "missing", "malformed" };
+
+	/* the whole set is dropped at once, so every sprite and the bookkeeping go in one arena */
+	int count = viewer_asset_count(is_sprite);
+	arena_t arena = arena_create(VIEWER_SPRITE_ARENA_SIZE, true);
+	sprite_t* sprites = arena_alloc(arena, count * sizeof * sprites);
+	file_status_t* statuses = arena_alloc(arena, count * sizeof * statuses);
+	int valid = game_pack
+		? pack_load_sprites(game_pack, is_sprite ? sprite_first : layer_first, count, arena, sprites, statuses)
+		: file_load_sprites(is_sprite ? sprite_directories : layer_directories, count, arena, sprites, statuses);
+	for (int i = 0; i < count; i++)
+	{
+		if (statuses[i] != FILE_STATUS_OK)
+		{
+			printf("%s: %s\n", viewer_asset_name(is_sprite, i), status_names[statuses[i]]);
+		}
+		else if (game_pack && !pack_verify(game_pack, (is_sprite ? sprite_first : layer_first) + i))
+		{
+			printf("%s: hash mismatch\n", viewer_asset_name(is_sprite, i));
+			valid--;
+		}
+	}
+	arena_destroy(arena);
+	return valid;
+}
+
+/* Loads every asset once and reports the ones that fail, without opening the console screen */
+static int viewer_validate(void)
+{
+	uint64_t start = debug_time_ns();
+	int sprites_loaded = viewer_validate_directories(true);
+	int layers_loaded = viewer_validate_directories(false);
+	printf("Loaded %i/%i sprites and %i/%i layers in %llu ms\n", sprites_loaded, sprite_directory_count, layers_loaded, layer_directory_count, (unsigned long long)((debug_time_ns() - start) / 1000000));
+	return sprites_loaded == sprite_directory_count && layers_loaded == layer_directory_count ? 0 : 1;
+}
+
+/* Packs every sprite and layer found in the game's directory into output */
+static int viewer_build_pack(const char* output)
+{
+	int count = sprite_directory_count + layer_directory_count;
+	char** files = arena_alloc(paths, count * sizeof * files);
+	char** names = arena_alloc(paths, count * sizeof * names);
+	for (int i = 0; i < count; i++)
+	{
+		bool is_sprite = i < sprite_directory_count;
+		files[i] = is_sprite ? sprite_directories[i] : layer_directories[i - sprite_directory_count];
+		/* named by folder and file name, with the same separator everywhere */
+		const char* file_name = strrchr(files[i], PATH_SEPARATOR[0]) + 1;
+		size_t size = strlen(file_name) + sizeof "Sprites/";
+		names[i] = arena_alloc(paths, size);
+		snprintf(names[i], size, "%s%s", is_sprite ? "Sprites/" : "Layers/", file_name);
+	}
+	if (!pack_build(output, files, names, count))
+	{
+		return 1;
+	}
+	printf("Packed %i sprites and %i layers into \"%s\"\n", sprite_directory_count, layer_directory_count, output);
+	return 0;
+}
+
+static struct export_batch
+{
+	export_cache_t cache;
+	/* ends in a path separator */
+	char output[MAX_PATH];
+	volatile int32_t exported;
+} export_batch;
+
+static void viewer_make_directory(const char* path)
+{
+#ifdef _WIN32
+	CreateDirectoryA(path, NULL);
+#else
+	mkdir(path, 0755);
+#endif
+}
+
+static void viewer_export_job(void* param, int index)
+{
+	(void)param;
+	bool is_sprite = index < sprite_directory_count;
+	index -= is_sprite ? 0 : sprite_directory_count;
+	sprite_t sprite = viewer_asset_load(is_sprite, index);
+	if (!sprite)
+	{
+		return;
+	}
+	/* pack names use '/' whatever the platform */
+	const char* name = viewer_asset_name(is_sprite, index);
+	const char* file_name = strrchr(name, game_pack ? '/' : PATH_SEPARATOR[0]);
+	file_name = file_name ? file_name + 1 : name;
+	const char* extension = strrchr(file_name, '.');
+	int length = extension ? (int)(extension - file_name) : (int)strlen(file_name);
+	char path[sizeof export_batch.output + MAX_PATH];
+	snprintf(path, sizeof path, "%s%s" PATH_SEPARATOR "%.*s.ppm", export_batch.output, is_sprite ? "Sprites" : "Layers", length, file_name);
+	if (export_sprite_ppm(export_batch.cache, sprite, path))
+	{
+		atomic_add32(&export_batch.exported, 1);
+	}
+	screen_sprite_destroy(sprite);
+}
+
+/* Renders every sprite and layer to an image under output, across every core */
+static int viewer_export(const char* output)
+{
+	uint64_t start = debug_time_ns();
+	size_t length = strlen(output);
+	bool has_separator = length && (output[length - 1] == '/' || output[length - 1] == PATH_SEPARATOR[0]);
+	snprintf(export_batch.output, sizeof export_batch.output, "%s%s", output, has_separator ? "" : PATH_SEPARATOR);
+	char directory[sizeof export_batch.output + sizeof "Sprites"];
+	viewer_make_directory(output);
+	snprintf(directory, sizeof directory, "%sSprites", export_batch.output);
+	viewer_make_directory(directory);
+	snprintf(directory, sizeof directory, "%sLayers", export_batch.output);
+	viewer_make_directory(directory);
+
+	int count = sprite_directory_count + layer_directory_count;
+	export_batch.cache = export_cache_create();
+	thread_parallel_for(count, viewer_export_job, NULL);
+	export_cache_destroy(export_batch.cache);
+	printf("Exported %i/%i assets to \"%s\" in %llu ms\n", export_batch.exported, count, export_batch.output, (unsigned long long)((debug_time_ns() - start) / 1000000));
+	return export_batch.exported == count ? 0 : 1;
+}
+
+/* one loaded asset's plane, keyed by the store's pointer so equal planes sort next to each other */
+struct viewer_plane
+{
+	const void* plane;
+	/* the other plane, only compared when looking for assets identical in both */
+	const void* other;
+	int index;
+	/* run-length encoded, Image and Color are one plane so the asset only counts as identical */
+	bool is_encoded;
+};
+
+static sprite_t* duplicate_sprites;
+
+static void viewer_duplicates_load_job(void* param, int index)
+{
+	(void)param;
+	bool is_sprite = index < sprite_directory_count;
+	duplicate_sprites[index] = viewer_asset_load(is_sprite, is_sprite ? index : index - sprite_directory_count);
+}
+
+static int viewer_compare_planes(const void* a, const void* b)
+{
+	const struct viewer_plane* left = a;
+	const struct viewer_plane* right = b;
+	if (left->plane != right->plane)
+	{
+		return (uintptr_t)left->plane < (uintptr_t)right->plane ? -1 : 1;
+	}
+	if (left->other != right->other)
+	{
+		return (uintptr_t)left->other < (uintptr_t)right->other ? -1 : 1;
+	}
+	return left->index - right->index;
+}
+
+/* Prints every run of assets sharing a plane, or both planes when is_identical is set. Returns the number of groups. */
+static int viewer_report_groups(const char* label, struct viewer_plane* planes, int count, bool is_identical)
+{
+	qsort(planes, count, sizeof * planes, viewer_compare_planes);
+	int groups = 0;
+	for (int first = 0, last; first < count; first = last)
+	{
+		for (last = first + 1; last < count && planes[last].plane == planes[first].plane && (!is_identical || planes[last].other == planes[first].other); last++);
+		if (last - first < 2)
+		{
+			continue;
+		}
+		groups++;
+		printf("%s shared by %i:", label, last - first);
+		for (int i = first; i < last; i++)
+		{
+			bool is_sprite = planes[i].index < sprite_directory_count;
+			printf(" %s", viewer_asset_name(is_sprite, is_sprite ? planes[i].index : planes[i].index - sprite_directory_count));
+		}
+		printf("\n");
+	}
+	return groups;
+}
+
+/* Loads every asset into the plane store and lists the groups that ended up sharing Image or Color planes */
+static int viewer_duplicates(void)
+{
+	int count = sprite_directory_count + layer_directory_count;
+	duplicate_sprites = dig_malloc(count * sizeof * duplicate_sprites);
+	thread_parallel_for(count, viewer_duplicates_load_job, NULL);
+
+	struct viewer_plane* planes = dig_malloc(count * sizeof * planes);
+	int stored = 0;
+	for (int i = 0; i < count; i++)
+	{
+		sprite_t sprite = duplicate_sprites[i];
+		if (sprite)
+		{
+			/* run-length encoded sprites keep Image and Color together, so the runs stand for both */
+			const void* runs = screen_sprite_runs(sprite);
+			planes[stored++] = (struct viewer_plane) { runs ? runs : screen_sprite_text(sprite), runs ? runs : (const void*)screen_sprite_attrib(sprite), i, runs != NULL };
+		}
+	}
+	int identical = viewer_report_groups("Identical", planes, stored, true);
+	/* encoded sprites were only shared whole, listing them again under Image and Color would count them twice */
+	int dense = 0;
+	for (int i = 0; i < stored; i++)
+	{
+		if (!planes[i].is_encoded)
+		{
+			planes[dense++] = planes[i];
+		}
+	}
+	int images = viewer_report_groups("Image", planes, dense, false);
+	for (int i = 0; i < dense; i++)
+	{
+		const void* plane = planes[i].plane;
+		planes[i].plane = planes[i].other;
+		planes[i].other = plane;
+	}
+	int colors = viewer_report_groups("Color", planes, dense, false);
+
+	store_statistics_t statistics;
+	store_statistics(&statistics);
+	printf("%i identical, %i Image and %i Color groups across %i/%i assets, %i planes in %.2f MB instead of %i in %.2f MB\n",
+		identical, images, colors, stored, count, statistics.planes, statistics.bytes / 1e6, statistics.references, statistics.referenced_bytes / 1e6);
+
+	for (int i = 0; i < count; i++)
+	{
+		screen_sprite_destroy(duplicate_sprites[i]);
+	}
+	free(planes);
+	free(duplicate_sprites);
+	return stored == count ? 0 : 1;
+}
+
+static void viewer_start_prefetch(size_t cache_bytes)
+{
+	loaded = lru_create(cache_bytes);
+	prefetch.lock = mutex_create();
+	prefetch.wake = condition_create();
+	prefetch.loaded_key = -1;
+	for (int i = 0; i < VIEWER_GALLERY_SIZE; i++)
+	{
+		prefetch.page_keys[i] = -1;
+	}
+	prefetch.thread = thread_create(viewer_prefetch_thread, NULL);
+	viewer_gallery_create_cursor();
+}
+
+static void viewer_start_watch(void)
+{
+	/* packs don't change underneath the viewer */
+	if (game_pack)
+	{
+		return;
+	}
+	char sprite_path[MAX_PATH], layer_path[MAX_PATH];
+	snprintf(sprite_path, sizeof sprite_path, "%sSprites" PATH_SEPARATOR, game_path);
+	snprintf(layer_path, sizeof layer_path, "%sLayers" PATH_SEPARATOR, game_path);
+	char* directories[] = { sprite_path, layer_path };
+	hot_reload.lock = mutex_create();
+	hot_reload.watch = watch_create(directories, 2, viewer_handle_change, NULL);
 }
 
 static void viewer_destroy(void)
 {
-	screen_sprite_destroy(current);
-	for (int i = 0; i < sizeof sprite_directories / sizeof * sprite_directories; i++)
+	/* stopped first, it's the only thing that can hand the UI thread a sprite */
+	watch_destroy(hot_reload.watch);
+	if (hot_reload.lock)
 	{
-		free(sprite_directories[i]);
+		for (int i = 0; i < hot_reload.count; i++)
+		{
+			screen_sprite_destroy(hot_reload.entries[i].sprite);
+		}
+		free(hot_reload.entries);
+		mutex_destroy(hot_reload.lock);
+	}
+	if (prefetch.thread)
+	{
+		mutex_lock(prefetch.lock);
+		prefetch.quit = true;
+		condition_signal(prefetch.wake);
+		mutex_unlock(prefetch.lock);
+		thread_join(prefetch.thread);
 	}
+	condition_destroy(prefetch.wake);
+	mutex_destroy(prefetch.lock);
+	/* the cache owns current and the gallery's sprites */
+	viewer_gallery_release();
+	screen_sprite_destroy(gallery.cursor);
+	lru_destroy(loaded);
+	arena_destroy(paths);
+	pack_close(game_pack);
+}
+
+static void viewer_dump_profile(void)
+{
+	profile_dump(profile_output);
 }
 
-int main()
+int main(int argc, char** argv)
 {
-	screen_initialize((screen_events_t) { viewer_handle_repaint, viewer_handle_keyboard });
-	viewer_initialize();
+	bool validate = false, bench = false, duplicates = false;
+	const char* bench_output = NULL;
+	const char* pack_path = NULL;
+	const char* pack_output = NULL;
+	const char* export_output = NULL;
+	const char* palettes_path = NULL;
+	size_t cache_bytes = VIEWER_CACHE_BYTES;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--validate") == 0)
+		{
+			validate = true;
+		}
+		else if (strcmp(argv[i], "--duplicates") == 0)
+		{
+			duplicates = true;
+		}
+		else if (strcmp(argv[i], "--bench") == 0)
+		{
+			bench = true;
+			bench_output = i + 1 < argc && argv[i + 1][0] != '-' ? argv[++i] : NULL;
+		}
+		else if (strcmp(argv[i], "--cache-bytes") == 0 && i + 1 < argc)
+		{
+			cache_bytes = strtoull(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--game") == 0 && i + 1 < argc)
+		{
+			/* expected to end in a path separator, like DIG_N_RIG_PATH */
+			game_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc)
+		{
+			pack_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--build-pack") == 0 && i + 1 < argc)
+		{
+			pack_output = argv[++i];
+		}
+		else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+		{
+			profile_output = argv[++i];
+			profile_enable(true);
+		}
+		else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc)
+		{
+			log_open(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc)
+		{
+			export_output = argv[++i];
+		}
+		else if (strcmp(argv[i], "--palettes") == 0 && i + 1 < argc)
+		{
+			palettes_path = argv[++i];
+		}
+	}
+
+	if (profile_output)
+	{
+		/* every way out of main, validate and export included */
+		atexit(viewer_dump_profile);
+	}
+
+	if (bench)
+	{
+		/* runs on generated assets, so it doesn't need the game */
+		return bench_run(bench_output);
+	}
+
+	/* before anything is drawn or exported, the game's own palettes replace the built in ones when it has them */
+	char default_palettes[MAX_PATH];
+	uint64_t mtime, size;
+	snprintf(default_palettes, sizeof default_palettes, "%s" VIEWER_PALETTES_FILE, game_path);
+	if (palettes_path ? !screen_load_palettes(palettes_path) : file_stat(default_palettes, &mtime, &size) && !screen_load_palettes(default_palettes))
+	{
+		return 1;
+	}
+
+	/* a pack is always built from the loose files */
+	viewer_initialize(pack_output ? NULL : pack_path);
+	if (pack_output)
+	{
+		return viewer_build_pack(pack_output);
+	}
+	if (validate)
+	{
+		return viewer_validate();
+	}
+	if (export_output)
+	{
+		return viewer_export(export_output);
+	}
+	if (duplicates)
+	{
+		return viewer_duplicates();
+	}
+
+	screen_initialize((screen_events_t) { viewer_handle_repaint, viewer_handle_keyboard, viewer_handle_wake, viewer_handle_input_drained });
+	viewer_start_prefetch(cache_bytes);
+	viewer_start_watch();
+	pending_input.is_target_changed = true;
+	viewer_handle_input_drained();
 	
 	screen_loop();
 
+	viewer_destroy();
 	screen_destroy();
 
 	return 0;
@@ -0,0 +1,411 @@
+/*
+	watch.c ~ RL
+*/
+
+#include "watch.h"
+
+#include "debug.h"
+#include "log.h"
+#include "thread.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#elif defined(__linux__)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+/* a change is reported once its file has been quiet this long */
+#define WATCH_DEBOUNCE_MS 15
+/* or once it's been pending this long, so a file that's written continuously still shows up */
+#define WATCH_MAX_DELAY_MS 100
+#define WATCH_BUFFER_SIZE 16384
+#define WATCH_PATH_MAX 4096
+
+struct watch_pending
+{
+	char* path;
+	uint64_t first_change, last_change;
+};
+
+struct watch
+{
+	thread_t thread;
+	watch_callback_t callback;
+	void* param;
+	int count;
+	char** directories;
+	/* unique paths waiting for their burst of writes to end */
+	struct watch_pending* pending;
+	int pending_count, pending_capacity;
+#ifdef _WIN32
+	HANDLE quit;
+	HANDLE* handles;
+	OVERLAPPED* overlapped;
+	DWORD* buffers;
+#elif defined(__linux__)
+	int fd;
+	int* descriptors;
+	int quit_pipe[2];
+	char buffer[WATCH_BUFFER_SIZE];
+#endif
+};
+
+static void watch_add_pending(watch_t watch, int directory, const char* name, size_t length)
+{
+	char path[WATCH_PATH_MAX];
+	snprintf(path, sizeof path, "%s%.*s", watch->directories[directory], (int)length, name);
+
+	uint64_t now = debug_time_ns();
+	for (int i = 0; i < watch->pending_count; i++)
+	{
+		if (strcmp(watch->pending[i].path, path) == 0)
+		{
+			watch->pending[i].last_change = now;
+			return;
+		}
+	}
+	if (watch->pending_count == watch->pending_capacity)
+	{
+		watch->pending_capacity = watch->pending_capacity ? watch->pending_capacity * 2 : 8;
+		struct watch_pending* pending = dig_malloc(watch->pending_capacity * sizeof * pending);
+		if (watch->pending_count)
+		{
+			memcpy(pending, watch->pending, watch->pending_count * sizeof * pending);
+		}
+		free(watch->pending);
+		watch->pending = pending;
+	}
+	size_t size = strlen(path) + 1;
+	struct watch_pending* entry = &watch->pending[watch->pending_count++];
+	entry->path = dig_malloc(size);
+	memcpy(entry->path, path, size);
+	entry->first_change = entry->last_change = now;
+}
+
+static uint64_t watch_deadline(const struct watch_pending* entry)
+{
+	uint64_t quiet = entry->last_change + WATCH_DEBOUNCE_MS * 1000000ull;
+	uint64_t latest = entry->first_change + WATCH_MAX_DELAY_MS * 1000000ull;
+	return quiet < latest ? quiet : latest;
+}
+
+/* How long to wait for more events before the next entry is due, -1 when nothing is pending */
+static int watch_timeout(watch_t watch)
+{
+	if (!watch->pending_count)
+	{
+		return -1;
+	}
+	uint64_t deadline = watch_deadline(&watch->pending[0]);
+	for (int i = 1; i < watch->pending_count; i++)
+	{
+		uint64_t next = watch_deadline(&watch->pending[i]);
+		deadline = next < deadline ? next : deadline;
+	}
+	uint64_t now = debug_time_ns();
+	return deadline > now ? (int)((deadline - now + 999999) / 1000000) : 0;
+}
+
+/* Reports the entries whose deadline has passed, the rest keep waiting in order */
+static void watch_flush(watch_t watch)
+{
+	uint64_t now = debug_time_ns();
+	int kept = 0;
+	for (int i = 0; i < watch->pending_count; i++)
+	{
+		if (watch_deadline(&watch->pending[i]) > now)
+		{
+			watch->pending[kept++] = watch->pending[i];
+			continue;
+		}
+		watch->callback(watch->param, watch->pending[i].path);
+		free(watch->pending[i].path);
+	}
+	watch->pending_count = kept;
+}
+
+#ifdef _WIN32
+static bool watch_listen(watch_t watch, int directory)
+{
+	return ReadDirectoryChangesW(watch->handles[directory], watch->buffers + directory * (WATCH_BUFFER_SIZE / sizeof * watch->buffers), WATCH_BUFFER_SIZE,
+		FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME, NULL, &watch->overlapped[directory], NULL);
+}
+
+static void watch_thread(void* param)
+{
+	watch_t watch = param;
+	/* the quit event is first, so it wins over pending changes */
+	HANDLE events[MAXIMUM_WAIT_OBJECTS];
+	events[0] = watch->quit;
+	for (int i = 0; i < watch->count; i++)
+	{
+		events[i + 1] = watch->overlapped[i].hEvent;
+	}
+
+	for (;;)
+	{
+		int timeout = watch_timeout(watch);
+		DWORD ready = WaitForMultipleObjects(watch->count + 1, events, FALSE, timeout < 0 ? INFINITE : (DWORD)timeout);
+		if (ready == WAIT_OBJECT_0 || ready == WAIT_FAILED)
+		{
+			return;
+		}
+		if (ready == WAIT_TIMEOUT)
+		{
+			watch_flush(watch);
+			continue;
+		}
+
+		int directory = ready - WAIT_OBJECT_0 - 1;
+		DWORD size;
+		if (GetOverlappedResult(watch->handles[directory], &watch->overlapped[directory], &size, FALSE) && size > 0)
+		{
+			const char* p = (const char*)(watch->buffers + directory * (WATCH_BUFFER_SIZE / sizeof * watch->buffers));
+			for (;;)
+			{
+				const FILE_NOTIFY_INFORMATION* info = (const FILE_NOTIFY_INFORMATION*)p;
+				if (info->Action == FILE_ACTION_MODIFIED || info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_RENAMED_NEW_NAME)
+				{
+					char name[MAX_PATH];
+					int length = WideCharToMultiByte(CP_ACP, 0, info->FileName, info->FileNameLength / sizeof(WCHAR), name, sizeof name, NULL, NULL);
+					watch_add_pending(watch, directory, name, length);
+				}
+				if (!info->NextEntryOffset)
+				{
+					break;
+				}
+				p += info->NextEntryOffset;
+			}
+		}
+		/* a zero size means the buffer overflowed and changes were lost, there's nothing to do but carry on */
+		if (!watch_listen(watch, directory))
+		{
+			log_warning("Stopped watching \"%s\"\n", watch->directories[directory]);
+			return;
+		}
+		/* a steady stream of changes never times out the wait, so the max delay is checked after every one */
+		watch_flush(watch);
+	}
+}
+
+static bool watch_open(watch_t watch)
+{
+	if (watch->count + 1 > MAXIMUM_WAIT_OBJECTS)
+	{
+		return false;
+	}
+	watch->quit = CreateEventA(NULL, TRUE, FALSE, NULL);
+	watch->handles = dig_malloc(watch->count * sizeof * watch->handles);
+	watch->overlapped = dig_malloc(watch->count * sizeof * watch->overlapped);
+	watch->buffers = dig_malloc(watch->count * WATCH_BUFFER_SIZE);
+	memset(watch->overlapped, 0, watch->count * sizeof * watch->overlapped);
+	for (int i = 0; i < watch->count; i++)
+	{
+		watch->handles[i] = INVALID_HANDLE_VALUE;
+	}
+	for (int i = 0; i < watch->count; i++)
+	{
+		watch->handles[i] = CreateFileA(watch->directories[i], FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+		watch->overlapped[i].hEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+		if (watch->handles[i] == INVALID_HANDLE_VALUE || !watch_listen(watch, i))
+		{
+			log_error("Failed to watch \"%s\"\n", watch->directories[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void watch_close(watch_t watch)
+{
+	if (!watch->handles)
+	{
+		return;
+	}
+	for (int i = 0; i < watch->count; i++)
+	{
+		if (watch->handles[i] != INVALID_HANDLE_VALUE)
+		{
+			CancelIo(watch->handles[i]);
+			CloseHandle(watch->handles[i]);
+		}
+		if (watch->overlapped[i].hEvent)
+		{
+			CloseHandle(watch->overlapped[i].hEvent);
+		}
+	}
+	CloseHandle(watch->quit);
+	free(watch->handles);
+	free(watch->overlapped);
+	free(watch->buffers);
+}
+
+static void watch_signal_quit(watch_t watch)
+{
+	SetEvent(watch->quit);
+}
+#elif defined(__linux__)
+static void watch_thread(void* param)
+{
+	watch_t watch = param;
+	for (;;)
+	{
+		struct pollfd pfds[2] = { { .fd = watch->quit_pipe[0], .events = POLLIN }, { .fd = watch->fd, .events = POLLIN } };
+		int ready = poll(pfds, 2, watch_timeout(watch));
+		if (ready < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (ready < 0 || pfds[0].revents)
+		{
+			return;
+		}
+		if (ready == 0)
+		{
+			watch_flush(watch);
+			continue;
+		}
+
+		ssize_t size = read(watch->fd, watch->buffer, sizeof watch->buffer);
+		for (char* p = watch->buffer; size > 0 && p < watch->buffer + size; )
+		{
+			const struct inotify_event* event = (const struct inotify_event*)p;
+			p += sizeof * event + event->len;
+			if (!event->len || (event->mask & IN_ISDIR))
+			{
+				continue;
+			}
+			for (int i = 0; i < watch->count; i++)
+			{
+				if (watch->descriptors[i] == event->wd)
+				{
+					watch_add_pending(watch, i, event->name, strlen(event->name));
+					break;
+				}
+			}
+		}
+		/* a steady stream of changes never times out the poll, so the max delay is checked after every one */
+		watch_flush(watch);
+	}
+}
+
+static bool watch_open(watch_t watch)
+{
+	watch->quit_pipe[0] = watch->quit_pipe[1] = -1;
+	watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch->fd < 0 || pipe(watch->quit_pipe) != 0)
+	{
+		return false;
+	}
+	watch->descriptors = dig_malloc(watch->count * sizeof * watch->descriptors);
+	for (int i = 0; i < watch->count; i++)
+	{
+		/* close-write and moved-to cover editors that save in place and ones that save by renaming over the file, both only once the write is done */
+		watch->descriptors[i] = inotify_add_watch(watch->fd, watch->directories[i], IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (watch->descriptors[i] < 0)
+		{
+			log_error("Failed to watch \"%s\"\n", watch->directories[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void watch_close(watch_t watch)
+{
+	if (watch->fd >= 0)
+	{
+		close(watch->fd);
+	}
+	if (watch->quit_pipe[0] >= 0)
+	{
+		close(watch->quit_pipe[0]);
+		close(watch->quit_pipe[1]);
+	}
+	free(watch->descriptors);
+}
+
+static void watch_signal_quit(watch_t watch)
+{
+	char ch = 0;
+	if (write(watch->quit_pipe[1], &ch, 1) != 1)
+	{
+		log_error("Failed to stop the watch thread\n");
+	}
+}
+#else
+static void watch_thread(void* param)
+{
+}
+
+static bool watch_open(watch_t watch)
+{
+	return false;
+}
+
+static void watch_close(watch_t watch)
+{
+}
+
+static void watch_signal_quit(watch_t watch)
+{
+}
+#endif
+
+static void watch_free(watch_t watch)
+{
+	watch_close(watch);
+	for (int i = 0; i < watch->count; i++)
+	{
+		free(watch->directories[i]);
+	}
+	for (int i = 0; i < watch->pending_count; i++)
+	{
+		free(watch->pending[i].path);
+	}
+	free(watch->directories);
+	free(watch->pending);
+	free(watch);
+}
+
+watch_t watch_create(char** directories, int count, watch_callback_t callback, void* param)
+{
+	watch_t res = dig_malloc(sizeof * res);
+	memset(res, 0, sizeof * res);
+	res->callback = callback;
+	res->param = param;
+	res->count = count;
+	res->directories = dig_malloc(count * sizeof * res->directories);
+	for (int i = 0; i < count; i++)
+	{
+		size_t size = strlen(directories[i]) + 1;
+		res->directories[i] = dig_malloc(size);
+		memcpy(res->directories[i], directories[i], size);
+	}
+
+	if (!watch_open(res))
+	{
+		log_warning("File watching isn't available, changes won't be reloaded\n");
+		watch_free(res);
+		return NULL;
+	}
+	res->thread = thread_create(watch_thread, res);
+	return res;
+}
+
+void watch_destroy(watch_t watch)
+{
+	if (!watch)
+	{
+		return;
+	}
+	watch_signal_quit(watch);
+	thread_join(watch->thread);
+	watch_free(watch);
+}
\ No newline at end of file
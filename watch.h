@@ -0,0 +1,19 @@
+/*
+	watch.h ~ RL
+
+	Reports files that change inside a set of directories, on its own thread. Bursts of writes to a file
+	are debounced into a single report once the file has been quiet for a moment.
+*/
+
+#pragma once
+
+#include "types.h"
+
+/* path is the watched directory, as it was given, followed by the file's name */
+typedef void (*watch_callback_t)(void* param, const char* path);
+typedef struct watch* watch_t;
+
+/* Directories are expected to end in a path separator. Returns NULL if the platform can't watch them. */
+watch_t watch_create(char** directories, int count, watch_callback_t callback, void* param);
+/* Waits for a callback that's already running to return */
+void watch_destroy(watch_t watch);
\ No newline at end of file